@@ -11,4 +11,22 @@ __kernel void column_reader(__global float *src, __global float *trg, int target
 {
 	int i = get_global_id(0);
 	trg[i] = src[target_col + i*stride];
-}
\ No newline at end of file
+}
+// Linearized 2D scatter/gather as used by cl_rect_update_lib before switching to a 2D NDRange,
+// kept for comparing the cost of the per-item division and modulo.
+
+__kernel void upload_2D_linear(__global float *src, __global float *trg, uint pos_x, uint pos_y, uint size_x, uint size_y, uint stride)
+{
+	int i = get_global_id(0);
+	int line = i/size_x + pos_y;
+	int col = i%size_x + pos_x;
+	trg[col + line*stride] = src[i];
+}
+
+__kernel void download_2D_linear(__global float *src, __global float *trg, uint pos_x, uint pos_y, uint size_x, uint size_y, uint stride)
+{
+	int i = get_global_id(0);
+	int line = i/size_x + pos_y;
+	int col = i%size_x + pos_x;
+	trg[i] = src[col + line*stride];
+}
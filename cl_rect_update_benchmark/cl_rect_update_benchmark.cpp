@@ -12,6 +12,10 @@ constexpr int NUM_INNER_REPETITIONS = 10;
 constexpr int NUM_SIZES = 8;
 constexpr int START_SIZE = 64;
 constexpr int NUM_TYPES = 6;
+constexpr int NUM_SIZES_3D = 5;
+constexpr int START_SIZE_3D = 16;
+constexpr int NUM_TYPES_3D = 4;
+constexpr int NUM_TYPES_COPY = 5;
 
 
 int main(int argc, char **argv) {
@@ -27,7 +31,19 @@ int main(int argc, char **argv) {
 	cl_device_id device = cluInitDevice(device_num, &context, &queue);
 	printf("\n%s",cluGetDeviceDescription(device, (unsigned int)device_num));
 
-	cl_rul::init_rect_update_lib(context, device, true);
+	cl_rul::init_rect_update_lib(context, device, true, true);
+
+	{
+		printf("\nCOST MODEL (latency us, row cost us, bandwidth bytes/us)\n");
+		const cl_rul::cost_model& model = cl_rul::get_cost_model();
+		const char* directions[3] = { "upload", "download", "copy" };
+		const cl_rul::transfer_costs* costs[3] = { &model.upload, &model.download, &model.copy };
+		for(int d = 0; d < 3; ++d) {
+			printf("%8s individual: %8.2lf %8.2lf %10.2lf\n", directions[d], costs[d]->individual.latency, costs[d]->individual.row_cost, costs[d]->individual.bandwidth);
+			printf("%8s     clrect: %8.2lf %8.2lf %10.2lf\n", directions[d], costs[d]->clrect.latency, costs[d]->clrect.row_cost, costs[d]->clrect.bandwidth);
+			printf("%8s     kernel: %8.2lf %8.2lf %10.2lf\n", directions[d], costs[d]->kernel.latency, costs[d]->kernel.row_cost, costs[d]->kernel.bandwidth);
+		}
+	}
 
 	// data
 
@@ -60,7 +76,12 @@ int main(int argc, char **argv) {
 	cl_kernel kernel_column_reader = clCreateKernel(program, "column_reader", &errcode);
 	CLU_ERRCHECK(errcode, "Failed to create column_reader kernel");
 
-	const char* names[NUM_TYPES] = { "Complete", "Rect/Rect", "Rect/Linear", "Individual" ,"Col Kernel", "Lib Kernel" };
+	cl_kernel kernel_upload_linear = clCreateKernel(program, "upload_2D_linear", &errcode);
+	CLU_ERRCHECK(errcode, "Failed to create upload_2D_linear kernel");
+	cl_kernel kernel_download_linear = clCreateKernel(program, "download_2D_linear", &errcode);
+	CLU_ERRCHECK(errcode, "Failed to create download_2D_linear kernel");
+
+	const char* names[NUM_TYPES] = { "Complete", "Rect/Rect", "Rect/Linear", "Individual" ,"Col Kernel", "Lib Auto" };
 
 	{
 		printf("\nUPLOAD (Host -> GPU) times in microseconds\n");
@@ -290,4 +311,233 @@ int main(int argc, char **argv) {
 			}
 		}
 	}
+
+	{
+		// re-tiling: the top left quadrant of each buffer is copied into the interior of a tile with a halo of one cell,
+		// either through the host (the only option before copy_rect) or on the device by each method
+		printf("\nCOPY (GPU -> GPU) times in microseconds\n");
+		const char* names_copy[NUM_TYPES_COPY] = { "Via Host", "Individual", "Rect", "Kernel", "Lib Auto" };
+		for(int i = 0; i < NUM_TYPES_COPY + 1; ++i) {
+			printf("%12s ", i == 0 ? "Side length" : names_copy[i - 1]);
+			printf(i == NUM_TYPES_COPY ? "\n" : ", ");
+		}
+
+		double results[NUM_SIZES][NUM_TYPES_COPY];
+		std::fill(&results[0][0], &results[NUM_SIZES][0], std::numeric_limits<float>::infinity());
+
+		cl_event cl_ev_before; // just for measurement
+		auto start_bench = [&](int s) {
+			clEnqueueWriteBuffer(queue, device_buffers[s], CL_FALSE, 0, 1, host_buffers[s], 0, NULL, &cl_ev_before);
+		};
+		auto end_bench = [&](int s, int id, cl_event cl_ev_transfer) {
+			clFinish(queue);
+			cl_ulong start, end;
+			CLU_ERRCHECK(clGetEventProfilingInfo(cl_ev_before, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &start, NULL), "Error reading start time");
+			CLU_ERRCHECK(clGetEventProfilingInfo(cl_ev_transfer, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL), "Error reading end time");
+			results[s][id] = std::min(results[s][id], ((double)(end - start) / 1000.0));
+		};
+
+		for(int s = 0; s < NUM_SIZES; ++s) {
+			const size_t side_length = (size_t)side_lengths[s];
+			const cl_rul::Extent full_extent = { side_length, side_length, 1u };
+			const cl_rul::Box quadrant = { { 0u,0u,0u },{ side_length / 2,side_length / 2,1u } };
+			const cl_rul::Extent tile_extent = { side_length / 2 + 2, side_length / 2 + 2, 1u };
+			const cl_rul::Point tile_origin = { 1u,1u,0u };
+			cl_mem tile_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, tile_extent.size() * sizeof(cl_float), NULL, &errcode);
+			CLU_ERRCHECK(errcode, "Failed to acquire device memory for tile buffer");
+
+			for(int r = 0; r < NUM_REPETITIONS * NUM_INNER_REPETITIONS; ++r) {
+				/// 1. download and upload
+				start_bench(s);
+				cl_event ev_download = cl_rul::download_rect<cl_float>(queue, device_buffers[s], full_extent, quadrant, (cl_float*)host_buffers[s]);
+				cl_event ev_upload = cl_rul::upload_rect<cl_float>(queue, tile_buffer, tile_extent, { tile_origin, quadrant.extent }, (cl_float*)host_buffers[s], ev_download);
+				end_bench(s, 0, ev_upload);
+				clReleaseEvent(ev_download);
+
+				/// 2. individual copy
+				// only test this on smaller sizes, kills some implementations
+				if(side_length <= 512) {
+					start_bench(s);
+					end_bench(s, 1, cl_rul::copy_rect<cl_float, cl_rul::Individual>(queue, device_buffers[s], full_extent, quadrant, tile_buffer, tile_extent, tile_origin));
+				}
+
+				/// 3. rect copy
+				start_bench(s);
+				end_bench(s, 2, cl_rul::copy_rect<cl_float, cl_rul::ClRect>(queue, device_buffers[s], full_extent, quadrant, tile_buffer, tile_extent, tile_origin));
+
+				/// 4. library kernel-based copy
+				start_bench(s);
+				end_bench(s, 3, cl_rul::copy_rect<cl_float, cl_rul::Kernel>(queue, device_buffers[s], full_extent, quadrant, tile_buffer, tile_extent, tile_origin));
+
+				/// 5. library-based copy
+				start_bench(s);
+				end_bench(s, 4, cl_rul::copy_rect<cl_float>(queue, device_buffers[s], full_extent, quadrant, tile_buffer, tile_extent, tile_origin));
+			}
+
+			clReleaseMemObject(tile_buffer);
+		}
+
+		for(int s = 0; s < NUM_SIZES; ++s) {
+			printf("%12d , ", side_lengths[s]);
+			for(int i = 0; i < NUM_TYPES_COPY; ++i) {
+				printf("%12.2lf", results[s][i]);
+				printf(i == NUM_TYPES_COPY - 1 ? "\n" : " , ");
+			}
+		}
+	}
+
+	{
+		// kernel execution time only, for the interior {side_length - 2, side_length - 2} box of each buffer
+		// and for a narrow {5, side_length - 2} strip, which the library moves with its tiled strip kernel
+		printf("\n2D SCATTER / GATHER KERNEL times in microseconds (linear index with div/mod vs. library kernels)\n");
+		printf("%12s , %12s , %12s , %12s , %12s , %12s , %12s\n", "Side length", "Up Linear", "Up NDRange", "Down Linear", "Down NDRange", "Strip Linear", "Strip Tiled");
+
+		double results[NUM_SIZES][6];
+		std::fill(&results[0][0], &results[NUM_SIZES][0], std::numeric_limits<float>::infinity());
+
+		auto kernel_time = [&](cl_event ev) {
+			clFinish(queue);
+			cl_ulong start, end;
+			CLU_ERRCHECK(clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL), "Error reading start time");
+			CLU_ERRCHECK(clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL), "Error reading end time");
+			clReleaseEvent(ev);
+			return (double)(end - start) / 1000.0;
+		};
+
+		for(int s = 0; s < NUM_SIZES; ++s) {
+			const size_t side_length = (size_t)side_lengths[s];
+			const cl_rul::Box box = { { 1u,1u,0u },{ side_length - 2,side_length - 2,1u } };
+			const cl_rul::Box strip = { { 1u,1u,0u },{ 5u,side_length - 2,1u } };
+			cl_mem linear_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, box.size() * sizeof(cl_float), NULL, &errcode);
+			CLU_ERRCHECK(errcode, "Failed to acquire device memory for linear buffer");
+
+			cl_uint pos_x = 1, pos_y = 1, size_x = (cl_uint)box.extent.xs, size_y = (cl_uint)box.extent.ys, stride = (cl_uint)side_length;
+			size_t global_size = box.size();
+			for(int r = 0; r < NUM_REPETITIONS; ++r) {
+				cl_event ev;
+				cluSetKernelArguments(kernel_upload_linear, 7, sizeof(cl_mem), &linear_buffer, sizeof(cl_mem), &device_buffers[s],
+					sizeof(cl_uint), &pos_x, sizeof(cl_uint), &pos_y, sizeof(cl_uint), &size_x, sizeof(cl_uint), &size_y, sizeof(cl_uint), &stride);
+				CLU_ERRCHECK(clEnqueueNDRangeKernel(queue, kernel_upload_linear, 1, NULL, &global_size, NULL, 0, NULL, &ev), "Error enqueueing linear upload kernel");
+				results[s][0] = std::min(results[s][0], kernel_time(ev));
+
+				// the event returned by the Kernel method is the one of its scatter kernel
+				ev = cl_rul::upload_rect<cl_float, cl_rul::Kernel>(queue, device_buffers[s], { side_length,side_length,1u }, box, (cl_float*)host_buffers[s]);
+				results[s][1] = std::min(results[s][1], kernel_time(ev));
+
+				cluSetKernelArguments(kernel_download_linear, 7, sizeof(cl_mem), &device_buffers[s], sizeof(cl_mem), &linear_buffer,
+					sizeof(cl_uint), &pos_x, sizeof(cl_uint), &pos_y, sizeof(cl_uint), &size_x, sizeof(cl_uint), &size_y, sizeof(cl_uint), &stride);
+				CLU_ERRCHECK(clEnqueueNDRangeKernel(queue, kernel_download_linear, 1, NULL, &global_size, NULL, 0, NULL, &ev), "Error enqueueing linear download kernel");
+				results[s][2] = std::min(results[s][2], kernel_time(ev));
+
+				// gather kernel through the library, measured directly since download_rect returns the staging transfer
+				ev = cl_rul::detail::enqueue_download_kernel_2D<cl_float>(cl_rul::detail::instance_of(queue), queue, device_buffers[s], { side_length,side_length,1u }, box, linear_buffer, cl_rul::WaitList());
+				results[s][3] = std::min(results[s][3], kernel_time(ev));
+
+				cl_uint strip_x = (cl_uint)strip.extent.xs;
+				size_t strip_global_size = strip.size();
+				cluSetKernelArguments(kernel_upload_linear, 7, sizeof(cl_mem), &linear_buffer, sizeof(cl_mem), &device_buffers[s],
+					sizeof(cl_uint), &pos_x, sizeof(cl_uint), &pos_y, sizeof(cl_uint), &strip_x, sizeof(cl_uint), &size_y, sizeof(cl_uint), &stride);
+				CLU_ERRCHECK(clEnqueueNDRangeKernel(queue, kernel_upload_linear, 1, NULL, &strip_global_size, NULL, 0, NULL, &ev), "Error enqueueing linear upload kernel");
+				results[s][4] = std::min(results[s][4], kernel_time(ev));
+
+				ev = cl_rul::upload_rect<cl_float, cl_rul::Kernel>(queue, device_buffers[s], { side_length,side_length,1u }, strip, (cl_float*)host_buffers[s]);
+				results[s][5] = std::min(results[s][5], kernel_time(ev));
+			}
+
+			clReleaseMemObject(linear_buffer);
+		}
+
+		for(int s = 0; s < NUM_SIZES; ++s) {
+			printf("%12d , ", side_lengths[s]);
+			for(int i = 0; i < 6; ++i) {
+				printf("%12.2lf", results[s][i]);
+				printf(i == 5 ? "\n" : " , ");
+			}
+		}
+	}
+
+	{
+		// x-faces ({1, side_length, side_length} boxes) of cubic buffers, the most strided 3D halo
+		printf("\n3D X-FACE UPLOAD (left) / DOWNLOAD (right) times in microseconds\n");
+		const char* names_3D[NUM_TYPES_3D] = { "Complete", "Rect/Linear", "Individual", "Lib Kernel" };
+		for(int i = 0; i < NUM_TYPES_3D + 1; ++i) {
+			printf("%12s ", i == 0 ? "Side length" : names_3D[i - 1]);
+			printf(", ");
+		}
+		for(int i = 0; i < NUM_TYPES_3D; ++i) {
+			printf("%12s ", names_3D[i]);
+			printf(i == NUM_TYPES_3D - 1 ? "\n" : ", ");
+		}
+
+		double results[NUM_SIZES_3D][2][NUM_TYPES_3D];
+		std::fill(&results[0][0][0], &results[NUM_SIZES_3D][0][0], std::numeric_limits<float>::infinity());
+
+		for(int s = 0; s < NUM_SIZES_3D; ++s) {
+			const size_t side_length = (size_t)START_SIZE_3D << s;
+			const size_t byte_size = side_length * side_length * side_length * sizeof(cl_float);
+			cl_mem device_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, byte_size, NULL, &errcode);
+			CLU_ERRCHECK(errcode, "Failed to acquire device memory");
+			void* host_buffer = malloc(byte_size);
+
+			const cl_rul::Extent full_extent = { side_length, side_length, side_length };
+			const cl_rul::Box face = { { 0u,0u,0u },{ 1u,side_length,side_length } };
+
+			cl_event cl_ev_before; // just for measurement
+			auto start_bench = [&]() {
+				clEnqueueWriteBuffer(queue, device_buffer, CL_FALSE, 0, 1, host_buffer, 0, NULL, &cl_ev_before);
+			};
+			auto end_bench = [&](int dir, int id, cl_event cl_ev_transfer) {
+				clFinish(queue);
+				cl_ulong start, end;
+				CLU_ERRCHECK(clGetEventProfilingInfo(cl_ev_before, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &start, NULL), "Error reading start time");
+				CLU_ERRCHECK(clGetEventProfilingInfo(cl_ev_transfer, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL), "Error reading end time");
+				results[s][dir][id] = std::min(results[s][dir][id], ((double)(end - start) / 1000.0));
+			};
+
+			for(int r = 0; r < NUM_REPETITIONS * NUM_INNER_REPETITIONS; ++r) {
+				/// 1. complete transfer
+				start_bench();
+				cl_event ev_transfer;
+				errcode = clEnqueueWriteBuffer(queue, device_buffer, CL_FALSE, 0, byte_size, host_buffer, 0, NULL, &ev_transfer);
+				CLU_ERRCHECK(errcode, "Error enqueueing complete transfer");
+				end_bench(0, 0, ev_transfer);
+				start_bench();
+				errcode = clEnqueueReadBuffer(queue, device_buffer, CL_FALSE, 0, byte_size, host_buffer, 0, NULL, &ev_transfer);
+				CLU_ERRCHECK(errcode, "Error enqueueing complete transfer");
+				end_bench(1, 0, ev_transfer);
+
+				/// 2. rect / linear face transfer
+				start_bench();
+				end_bench(0, 1, cl_rul::upload_rect<cl_float, cl_rul::ClRect>(queue, device_buffer, full_extent, face, (cl_float*)host_buffer));
+				start_bench();
+				end_bench(1, 1, cl_rul::download_rect<cl_float, cl_rul::ClRect>(queue, device_buffer, full_extent, face, (cl_float*)host_buffer));
+
+				/// 3. individual face transfer
+				// only test this on smaller sizes, kills some implementations
+				if(side_length <= 64) {
+					start_bench();
+					end_bench(0, 2, cl_rul::upload_rect<cl_float, cl_rul::Individual>(queue, device_buffer, full_extent, face, (cl_float*)host_buffer));
+					start_bench();
+					end_bench(1, 2, cl_rul::download_rect<cl_float, cl_rul::Individual>(queue, device_buffer, full_extent, face, (cl_float*)host_buffer));
+				}
+
+				/// 4. library kernel-based transfer
+				start_bench();
+				end_bench(0, 3, cl_rul::upload_rect<cl_float, cl_rul::Kernel>(queue, device_buffer, full_extent, face, (cl_float*)host_buffer));
+				start_bench();
+				end_bench(1, 3, cl_rul::download_rect<cl_float, cl_rul::Kernel>(queue, device_buffer, full_extent, face, (cl_float*)host_buffer));
+			}
+
+			clReleaseMemObject(device_buffer);
+			free(host_buffer);
+		}
+
+		for(int s = 0; s < NUM_SIZES_3D; ++s) {
+			printf("%12d , ", START_SIZE_3D << s);
+			for(int i = 0; i < 2 * NUM_TYPES_3D; ++i) {
+				printf("%12.2lf", results[s][i / NUM_TYPES_3D][i % NUM_TYPES_3D]);
+				printf(i == 2 * NUM_TYPES_3D - 1 ? "\n" : " , ");
+			}
+		}
+	}
 }
@@ -0,0 +1,99 @@
+#include "../ext/cl_utils.h"
+#include <map>
+#include <vector>
+#include <string>
+
+#define CL_RUL_IMPL
+#include "../cl_rect_update_lib/cl_rect_update_lib.h"
+
+// Compiles the transfer kernels for the OpenCL devices of this machine and writes their binaries as a C++ source file,
+// which the cl_rect_update_kernels library embeds (see the CL_RUL_EMBED_KERNELS CMake option).
+
+using program_binaries = std::map<uint64_t, std::vector<unsigned char>>;
+
+template<typename T>
+void collect_programs(cl_rul::detail::cl_rul_context& lib, program_binaries& binaries) {
+	const cl_device_id device = lib.get_cl_device_id();
+	for(bool vectorized : { false, true }) {
+		if(vectorized && !cl_rul::detail::has_vector_kernels<T>(lib)) continue;
+		// types of the same size share their programs
+		const uint64_t key = cl_rul::detail::kernel_binary_key(device, cl_rul::detail::get_program_source(vectorized).c_str(), cl_rul::detail::transfer_kernel_options<T>(lib, vectorized));
+		if(binaries.count(key)) continue;
+		cl_program program = cl_rul::detail::start_program_build<T>(lib, vectorized, false).get();
+		std::vector<unsigned char> binary = cl_rul::detail::get_program_binary(program, device);
+		if(binary.empty()) {
+			fprintf(stderr, "cl_rect_update_embed - no binary for options: %s\n", cl_rul::detail::transfer_kernel_options<T>(lib, vectorized).c_str());
+			continue;
+		}
+		binaries[key] = std::move(binary);
+	}
+}
+
+bool write_source(const char* path, const program_binaries& binaries) {
+	FILE* out = fopen(path, "w");
+	if(!out) return false;
+	fprintf(out, "// Generated by cl_rect_update_embed, do not edit.\n\n#include \"cl_rect_update_lib.h\"\n\nnamespace cl_rul {\nnamespace detail {\n\n");
+	size_t n = 0;
+	for(const auto& entry : binaries) {
+		fprintf(out, "static const unsigned char program_%u[] = {", (unsigned)n++);
+		for(size_t i = 0; i < entry.second.size(); ++i) {
+			fprintf(out, i % 16 == 0 ? "\n\t0x%02x," : " 0x%02x,", entry.second[i]);
+		}
+		fprintf(out, "\n};\n\n");
+	}
+	// terminated by an empty entry, so the array is never empty
+	fprintf(out, "const embedded_program embedded_programs[] = {\n");
+	n = 0;
+	for(const auto& entry : binaries) {
+		fprintf(out, "\t{ 0x%016llxull, program_%u, sizeof(program_%u) },\n", (unsigned long long)entry.first, (unsigned)n, (unsigned)n);
+		++n;
+	}
+	fprintf(out, "\t{ 0ull, nullptr, 0 }\n};\n\nconst size_t num_embedded_programs = %u;\n\n}\n}\n", (unsigned)n);
+	return fclose(out) == 0;
+}
+
+int main(int argc, char **argv) {
+	if(argc < 2) {
+		printf("Usage: cl_rect_update_embed [OUTPUT FILE] [DEVICE NAME]...\n");
+		printf("Only devices whose name contains one of the given names are included, all devices if none are given.\n");
+		exit(1);
+	}
+	const std::vector<std::string> device_names(argv + 2, argv + argc);
+
+	cl_uint num_platforms = 0;
+	CLU_ERRCHECK(clGetPlatformIDs(0, NULL, &num_platforms), "Failed to query number of ocl platforms");
+	std::vector<cl_platform_id> platforms(num_platforms);
+	CLU_ERRCHECK(clGetPlatformIDs(num_platforms, platforms.data(), NULL), "Failed to retrieve ocl platforms");
+
+	program_binaries binaries;
+	for(cl_platform_id platform : platforms) {
+		cl_uint num_devices = 0;
+		if(clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, NULL, &num_devices) != CL_SUCCESS) continue;
+		std::vector<cl_device_id> devices(num_devices);
+		CLU_ERRCHECK(clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, num_devices, devices.data(), NULL), "Failed to retrieve ocl devices");
+
+		for(cl_device_id device : devices) {
+			const std::string name = cl_rul::detail::device_info_string(device, CL_DEVICE_NAME);
+			if(!device_names.empty() && std::none_of(device_names.begin(), device_names.end(), [&](const std::string& n) { return name.find(n) != std::string::npos; })) continue;
+			printf("cl_rect_update_embed - compiling transfer kernels for %s\n", name.c_str());
+
+			cl_int errcode;
+			cl_context context = clCreateContext(NULL, 1, &device, NULL, NULL, &errcode);
+			CLU_ERRCHECK(errcode, "Failed to create ocl context");
+			cl_rul::init_rect_update_lib(context, device, true);
+			cl_rul::detail::cl_rul_context& lib = cl_rul::detail::g_instances.get(context, device);
+			#define BUF_TYPE(_htype, _dtype) collect_programs<_htype>(lib, binaries);
+			#include "../cl_rect_update_lib/buffer_types.inc"
+			#undef BUF_TYPE
+			cl_rul::reset_rect_update_lib(context, device);
+			clReleaseContext(context);
+		}
+	}
+
+	if(binaries.empty()) fprintf(stderr, "cl_rect_update_embed - no matching devices, the kernels will be compiled at run time\n");
+	if(!write_source(argv[1], binaries)) {
+		fprintf(stderr, "cl_rect_update_embed - could not write %s\n", argv[1]);
+		exit(1);
+	}
+	return 0;
+}
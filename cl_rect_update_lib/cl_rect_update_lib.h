@@ -1,7 +1,7 @@
 #pragma once
 
 // On Windows, CL_RUL_GLOBAL_STORAGE can be used to enable sharing of the
-// global context across DLLs, by setting __declspec(dllexport / dllimport).
+// library instances across DLLs, by setting __declspec(dllexport / dllimport).
 #ifndef CL_RUL_GLOBAL_STORAGE
 #define CL_RUL_GLOBAL_STORAGE
 #endif
@@ -11,6 +11,32 @@
 #include <string>
 #include <sstream>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <tuple>
+#include <thread>
+#include <future>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <fstream>
+#include <iterator>
+#include <iomanip>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CL_RUL_STREAM_WIDTH 32
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CL_RUL_STREAM_WIDTH 16
+#endif
 
 #include "kernel_code.h"
 
@@ -53,150 +79,936 @@ namespace cl_rul {
 		};
 	};
 
+	/// Distances in elements between consecutive rows and slices of a box in host memory.
+	struct Pitch {
+		size_t row;
+		size_t slice;
+
+		/// Rows and slices of a box without gaps, as in linearized host data.
+		static Pitch packed(const Extent& e) {
+			return { e.xs, e.slice_size() };
+		}
+		/// A box within a host grid of extent "grid".
+		static Pitch of(const Extent& grid) {
+			return { grid.xs, grid.slice_size() };
+		}
+
+		bool is_packed(const Extent& e) const {
+			return (e.ys == 1 || row == e.xs) && (e.zs == 1 || slice == e.slice_size());
+		}
+	};
+
+	/// Events a transfer waits for before it starts, as the wait list of the clEnqueue* functions. The events are not retained.
+	struct WaitList {
+		cl_uint count;
+		const cl_event* events;
+
+		WaitList() : count(0), events(nullptr) {}
+		WaitList(cl_uint count, const cl_event* events) : count(count), events(count > 0 ? events : nullptr) {}
+		WaitList(const cl_event& ev) : count(ev != nullptr ? 1 : 0), events(ev != nullptr ? &ev : nullptr) {}
+		WaitList(const std::vector<cl_event>& evs) : count(static_cast<cl_uint>(evs.size())), events(evs.empty() ? nullptr : evs.data()) {}
+	};
+
+	/// Host copies //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	namespace host {
+
+		/// Copies of at least this many bytes use non-temporal stores, their destination is consumed by a transfer rather than the CPU.
+		constexpr size_t NON_TEMPORAL_MIN_BYTES = 1 << 20;
+		/// Copies of at least this many bytes are split across up to MAX_THREADS threads.
+		constexpr size_t PARALLEL_MIN_BYTES = 4 << 20;
+		constexpr size_t MAX_THREADS = 4;
+
+		/// A strided copy of "slices" x "rows" rows of "row_bytes" bytes each, with pitches in bytes.
+		struct box_copy {
+			void* dst;
+			const void* src;
+			size_t row_bytes;
+			size_t rows;
+			size_t slices;
+			size_t dst_row_pitch;
+			size_t dst_slice_pitch;
+			size_t src_row_pitch;
+			size_t src_slice_pitch;
+		};
+
+		namespace detail {
+
+			inline void copy_row(char* dst, const char* src, size_t bytes) {
+				// rows of a single element (columns) get a fixed-size copy, which the compiler inlines
+				switch(bytes) {
+				case 1: std::memcpy(dst, src, 1); return;
+				case 2: std::memcpy(dst, src, 2); return;
+				case 4: std::memcpy(dst, src, 4); return;
+				case 8: std::memcpy(dst, src, 8); return;
+				case 16: std::memcpy(dst, src, 16); return;
+				default: std::memcpy(dst, src, bytes);
+				}
+			}
+
+			/// Copies with non-temporal stores where the instruction set has them, the caller must call stream_fence afterwards.
+			inline void stream_row(char* dst, const char* src, size_t bytes) {
+#ifdef CL_RUL_STREAM_WIDTH
+				constexpr size_t W = CL_RUL_STREAM_WIDTH;
+				const size_t head = std::min(bytes, (W - reinterpret_cast<uintptr_t>(dst) % W) % W);
+				std::memcpy(dst, src, head);
+				dst += head;
+				src += head;
+				bytes -= head;
+				for(; bytes >= W; bytes -= W, dst += W, src += W) {
+#if CL_RUL_STREAM_WIDTH == 32
+					_mm256_stream_si256(reinterpret_cast<__m256i*>(dst), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)));
+#else
+					_mm_stream_si128(reinterpret_cast<__m128i*>(dst), _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+#endif
+				}
+#endif
+				std::memcpy(dst, src, bytes);
+			}
+
+			inline void stream_fence() {
+#ifdef CL_RUL_STREAM_WIDTH
+				_mm_sfence();
+#endif
+			}
+
+		} // namespace detail
+
+		/**
+		 * @brief Performs a strided copy on the host.
+		 *
+		 * Rows and slices that are contiguous on both sides are merged first. Large copies use non-temporal stores and are split
+		 * into pieces of rows, or of a single long row, across several threads.
+		 */
+		inline void copy(box_copy c) {
+			if(c.rows > 1 && c.dst_row_pitch == c.row_bytes && c.src_row_pitch == c.row_bytes) {
+				c.row_bytes *= c.rows;
+				c.rows = 1;
+			}
+			if(c.rows == 1 && c.slices > 1 && c.dst_slice_pitch == c.row_bytes && c.src_slice_pitch == c.row_bytes) {
+				c.row_bytes *= c.slices;
+				c.slices = 1;
+			}
+			const size_t lines = c.rows * c.slices;
+			const size_t total = lines * c.row_bytes;
+			if(total == 0) return;
+
+			const bool stream = total >= NON_TEMPORAL_MIN_BYTES;
+			size_t threads = 1;
+			if(total >= PARALLEL_MIN_BYTES) threads = std::min<size_t>(MAX_THREADS, std::max(1u, std::thread::hardware_concurrency()));
+			const size_t pieces_per_line = lines >= threads ? 1 : (threads + lines - 1) / lines;
+			const size_t pieces = lines * pieces_per_line;
+			const size_t piece_bytes = (c.row_bytes + pieces_per_line - 1) / pieces_per_line;
+
+			auto run = [&c, stream, pieces_per_line, piece_bytes](size_t first, size_t last) {
+				for(size_t i = first; i < last; ++i) {
+					const size_t line = i / pieces_per_line;
+					const size_t begin = i % pieces_per_line * piece_bytes;
+					const size_t end = std::min(c.row_bytes, begin + piece_bytes);
+					if(begin >= end) continue;
+					const size_t y = line % c.rows, z = line / c.rows;
+					char* dst = static_cast<char*>(c.dst) + z * c.dst_slice_pitch + y * c.dst_row_pitch + begin;
+					const char* src = static_cast<const char*>(c.src) + z * c.src_slice_pitch + y * c.src_row_pitch + begin;
+					if(stream) detail::stream_row(dst, src, end - begin);
+					else detail::copy_row(dst, src, end - begin);
+				}
+				if(stream) detail::stream_fence();
+			};
+
+			std::vector<std::thread> workers;
+			for(size_t t = 1; t < threads; ++t) workers.emplace_back(run, pieces * t / threads, pieces * (t + 1) / threads);
+			run(0, pieces / threads);
+			for(std::thread& w : workers) w.join();
+		}
+
+		inline void copy_bytes(void* dst, const void* src, size_t bytes) {
+			copy({ dst, src, bytes, 1, 1, bytes, bytes, bytes, bytes });
+		}
+
+		template<typename T>
+		box_copy make_box_copy(T* dst, const Pitch& dst_pitch, const T* src, const Pitch& src_pitch, const Extent& e) {
+			return { dst, src, e.xs * sizeof(T), e.ys, e.zs,
+				dst_pitch.row * sizeof(T), dst_pitch.slice * sizeof(T), src_pitch.row * sizeof(T), src_pitch.slice * sizeof(T) };
+		}
+
+		/// Copies a box between two host layouts, "dst" and "src" point to the first element of the box.
+		template<typename T>
+		void copy_box(T* dst, const Pitch& dst_pitch, const T* src, const Pitch& src_pitch, const Extent& e) {
+			copy(make_box_copy(dst, dst_pitch, src, src_pitch, e));
+		}
+
+		/// Linearizes a box laid out with "src_pitch" into "dst".
+		template<typename T>
+		void pack(T* dst, const T* src, const Pitch& src_pitch, const Extent& e) {
+			copy_box(dst, Pitch::packed(e), src, src_pitch, e);
+		}
+
+		/// Writes a linearized box to host memory laid out with "dst_pitch".
+		template<typename T>
+		void unpack(T* dst, const Pitch& dst_pitch, const T* src, const Extent& e) {
+			copy_box(dst, dst_pitch, src, Pitch::packed(e), e);
+		}
+
+	} // namespace host
+
+	/// Cost model ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	/// Estimated cost of one transfer method: a fixed per-call latency, a cost for every row and the achieved bandwidth.
+	struct method_cost {
+		double latency;   ///< microseconds per call
+		double row_cost;  ///< microseconds per transferred row
+		double bandwidth; ///< bytes per microsecond
+
+		double estimate(size_t rows, size_t bytes) const {
+			return latency + rows * row_cost + bytes / bandwidth;
+		}
+	};
+
+	struct transfer_costs {
+		method_cost individual;
+		method_cost clrect;
+		method_cost kernel;
+	};
+
+	/**
+	 * @brief Per-device cost model used by the Automatic method to pick a transfer method for each call.
+	 *
+	 * The defaults reproduce the previous fixed choice of the Kernel method; call init_rect_update_lib with calibrate = true to measure the actual device.
+	 */
+	struct cost_model {
+		transfer_costs upload;
+		transfer_costs download;
+		transfer_costs copy; ///< device to device, see copy_rect
+
+		static cost_model defaults() {
+			const transfer_costs costs = { { 0.0, 10.0, 5000.0 }, { 25.0, 1.0, 5000.0 }, { 20.0, 0.0, 5000.0 } };
+			return { costs, costs, costs };
+		}
+
+		/// Stores the model in a simple text format, returns false if the file could not be written.
+		bool save(const char* filename) const {
+			FILE* fp = fopen(filename, "w");
+			if(!fp) return false;
+			fprintf(fp, "cl_rul_cost_model 2\n");
+			const transfer_costs* directions[3] = { &upload, &download, &copy };
+			for(const transfer_costs* d : directions) {
+				for(const method_cost* m : { &d->individual, &d->clrect, &d->kernel }) {
+					fprintf(fp, "%.17g %.17g %.17g\n", m->latency, m->row_cost, m->bandwidth);
+				}
+			}
+			return fclose(fp) == 0;
+		}
+
+		/// Loads a model written by save, returns false and leaves the model unchanged if the file is missing or malformed.
+		bool load(const char* filename) {
+			FILE* fp = fopen(filename, "r");
+			if(!fp) return false;
+			cost_model loaded = defaults();
+			int version = 0;
+			bool ok = fscanf(fp, "cl_rul_cost_model %d", &version) == 1 && (version == 1 || version == 2);
+			// version 1 profiles have no copy costs, those keep their defaults
+			transfer_costs* directions[3] = { &loaded.upload, &loaded.download, &loaded.copy };
+			for(int d = 0; d < (version == 1 ? 2 : 3); ++d) {
+				for(method_cost* m : { &directions[d]->individual, &directions[d]->clrect, &directions[d]->kernel }) {
+					ok = ok && fscanf(fp, "%lf %lf %lf", &m->latency, &m->row_cost, &m->bandwidth) == 3 && m->bandwidth > 0.0;
+				}
+			}
+			fclose(fp);
+			if(ok) *this = loaded;
+			return ok;
+		}
+	};
+
 	/// Globals & Initialization ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 	namespace detail {
 
-		class cl_rul_context {
+		enum class method_id { Individual, ClRect, Kernel };
+		constexpr int NUM_METHOD_IDS = 3;
+
+		/// Identifies a class of transfers that is expected to favour the same method.
+		struct tuning_key {
+			size_t element_size;
+			int shape;  ///< 0: column, 1: narrow, 2: block; +3 for boxes spanning several slices
+			int volume; ///< floor(log2(bytes))
+
+			bool operator<(const tuning_key& other) const {
+				return std::tie(element_size, shape, volume) < std::tie(other.element_size, other.shape, other.volume);
+			}
+		};
+
+		inline tuning_key make_tuning_key(const Box& box, size_t element_size) {
+			const Extent& e = box.extent;
+			int shape = e.xs == 1 ? 0 : (e.xs * 4 <= e.ys ? 1 : 2);
+			if(e.zs > 1) shape += 3;
+			int volume = 0;
+			for(size_t bytes = box.size() * element_size; bytes > 1; bytes >>= 1) volume++;
+			return { element_size, shape, volume };
+		}
+
+		constexpr int RUNTIME_TRIALS = 3;
+		constexpr double RUNTIME_CANDIDATE_FACTOR = 8.0;
+
+		/**
+		 * @brief Online autotuner behind the Runtime method.
+		 *
+		 * Each bucket first runs every candidate method RUNTIME_TRIALS times, bracketed by a marker so the whole transfer can be timed
+		 * with event profiling. Samples are collected once their events have completed, so exploration never blocks the caller.
+		 * Once all samples are in, the bucket sticks with the fastest method.
+		 */
+		class runtime_tuner {
+		public:
+			struct choice {
+				method_id method;
+				bool sample;
+			};
+
+			/// candidates[m] is false for methods that the cost model considers hopeless for this bucket.
+			choice choose(const tuning_key& key, method_id fallback, const bool candidates[NUM_METHOD_IDS]) {
+				bucket& b = buckets[key];
+				harvest(b);
+				if(b.converged) return { b.best, false };
+
+				int pending[NUM_METHOD_IDS] = {};
+				for(const sample& smp : b.pending) pending[static_cast<int>(smp.method)]++;
+				bool waiting = false;
+				for(int m = NUM_METHOD_IDS - 1; m >= 0; --m) { // Kernel first
+					if(!candidates[m]) continue;
+					if(b.num_samples[m] + pending[m] < RUNTIME_TRIALS) return { static_cast<method_id>(m), true };
+					if(pending[m] > 0) waiting = true;
+				}
+				if(waiting) return { fallback, false };
+
+				b.best = fallback;
+				for(int m = 0; m < NUM_METHOD_IDS; ++m) {
+					if(candidates[m] && b.best_time[m] < b.best_time[static_cast<int>(b.best)]) b.best = static_cast<method_id>(m);
+				}
+				b.converged = true;
+				return { b.best, false };
+			}
+
+			/// Takes ownership of both events.
+			void record(const tuning_key& key, method_id method, cl_event ev_start, cl_event ev_end) {
+				buckets[key].pending.push_back({ method, ev_start, ev_end });
+			}
+
+			bool converged(const tuning_key& key, method_id& out_method) const {
+				auto it = buckets.find(key);
+				if(it == buckets.end() || !it->second.converged) return false;
+				out_method = it->second.best;
+				return true;
+			}
+
+			void reset() {
+				for(auto& kv : buckets) {
+					for(sample& smp : kv.second.pending) {
+						clReleaseEvent(smp.ev_start);
+						clReleaseEvent(smp.ev_end);
+					}
+				}
+				buckets.clear();
+			}
+
+		private:
+			struct sample {
+				method_id method;
+				cl_event ev_start;
+				cl_event ev_end;
+			};
+
+			struct bucket {
+				double best_time[NUM_METHOD_IDS] = { std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity() };
+				int num_samples[NUM_METHOD_IDS] = {};
+				std::vector<sample> pending;
+				bool converged = false;
+				method_id best = method_id::Kernel;
+			};
+
+			std::map<tuning_key, bucket> buckets;
+
+			static void harvest(bucket& b) {
+				auto done = std::remove_if(b.pending.begin(), b.pending.end(), [&b](const sample& smp) {
+					cl_int status = CL_QUEUED;
+					clGetEventInfo(smp.ev_end, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, nullptr);
+					if(status > CL_COMPLETE) return false;
+					cl_ulong start = 0, end = 0;
+					const int m = static_cast<int>(smp.method);
+					if(status == CL_COMPLETE
+						&& clGetEventProfilingInfo(smp.ev_start, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, nullptr) == CL_SUCCESS
+						&& clGetEventProfilingInfo(smp.ev_end, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, nullptr) == CL_SUCCESS) {
+						b.best_time[m] = std::min(b.best_time[m], (double)(end - start) / 1000.0);
+					}
+					// failed samples still count, so a method that errors out can not stall convergence
+					b.num_samples[m]++;
+					clReleaseEvent(smp.ev_start);
+					clReleaseEvent(smp.ev_end);
+					return true;
+				});
+				b.pending.erase(done, b.pending.end());
+			}
+		};
+
+		constexpr size_t MIN_STAGING_BUFFER_SIZE = 4096;
+		constexpr size_t MAX_STAGING_BUFFERS_IN_FLIGHT = 8;
+
+		/**
+		 * @brief Pool of staging buffers in power-of-two size classes.
+		 *
+		 * A buffer handed out by acquire() is returned with the event of the last command using it and only goes back to the
+		 * free lists once that event has completed, so transfers in flight never share a staging buffer.
+		 * Completed buffers are reclaimed on the next acquire; beyond MAX_STAGING_BUFFERS_IN_FLIGHT, acquire waits for the oldest
+		 * one whose command is already running, and otherwise allocates another buffer. A command that is merely queued or
+		 * submitted may wait for a user event which the caller only sets after the transfer call has returned.
+		 */
+		class staging_pool {
 		public:
-			void initialize(cl_context ctx, cl_device_id device) {
-				assert(cl_ctx == nullptr && cl_device == nullptr && "cl_rect_update_lib - already initialized.");
-				cl_ctx = ctx;
-				cl_device = device;
+			explicit staging_pool(cl_mem_flags flags = CL_MEM_READ_WRITE) : flags(flags) {}
+
+			cl_mem acquire(cl_context ctx, size_t size_in_bytes) {
+				const size_t class_size = size_class(size_in_bytes);
+				reclaim();
+				if(free_buffers[class_size].empty() && in_flight.size() >= MAX_STAGING_BUFFERS_IN_FLIGHT) {
+					auto running = std::find_if(in_flight.begin(), in_flight.end(), [](const pending& p) {
+						cl_int status = CL_QUEUED;
+						clGetEventInfo(p.ev_command, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, nullptr);
+						return status <= CL_RUNNING;
+					});
+					if(running != in_flight.end()) {
+						clWaitForEvents(1, &running->ev_done);
+						reclaim();
+					}
+				}
+
+				std::vector<cl_mem>& list = free_buffers[class_size];
+				if(!list.empty()) {
+					cl_mem buffer = list.back();
+					list.pop_back();
+					return buffer;
+				}
+				cl_int errcode = CL_SUCCESS;
+				cl_mem buffer = clCreateBuffer(ctx, flags, class_size, nullptr, &errcode);
+				CLU_ERRCHECK(errcode, "cl_rect_update_lib - error allocating staging buffer of size %u", (unsigned)class_size);
+				return buffer;
+			}
+
+			/// "ev_done" is the event of the last command accessing "buffer", it is retained by the pool.
+			/// Without an event, the buffer is free immediately. If "ev_done" is a user event of the library, "ev_command" is the
+			/// device command it follows, whose status tells acquire whether waiting for "ev_done" is safe.
+			void release(cl_mem buffer, cl_event ev_done, cl_event ev_command = nullptr) {
+				size_t size_in_bytes = 0;
+				clGetMemObjectInfo(buffer, CL_MEM_SIZE, sizeof(size_t), &size_in_bytes, nullptr);
+				if(ev_done == nullptr) {
+					free_buffers[size_in_bytes].push_back(buffer);
+					return;
+				}
+				if(ev_command == nullptr) ev_command = ev_done;
+				clRetainEvent(ev_done);
+				clRetainEvent(ev_command);
+				in_flight.push_back({ buffer, size_in_bytes, ev_done, ev_command });
+			}
+
+			/// Waits for all buffers in flight, afterwards every buffer of the pool is free.
+			void wait_idle() {
+				if(in_flight.empty()) return;
+				std::vector<cl_event> events;
+				for(const pending& p : in_flight) events.push_back(p.ev_done);
+				clWaitForEvents(static_cast<cl_uint>(events.size()), events.data());
+				reclaim();
 			}
 
 			void reset() {
-				cl_ctx = nullptr;
-				cl_device = nullptr;
-				if(staging_buffer != nullptr) {
-					clReleaseMemObject(staging_buffer);
-					staging_buffer = nullptr;
-					staging_buffer_size = 0;
+				wait_idle();
+				for(auto& kv : free_buffers) {
+					for(cl_mem buffer : kv.second) clReleaseMemObject(buffer);
+				}
+				free_buffers.clear();
+			}
+
+			static size_t size_class(size_t size_in_bytes) {
+				size_t class_size = MIN_STAGING_BUFFER_SIZE;
+				while(class_size < size_in_bytes) class_size *= 2;
+				return class_size;
+			}
+
+		private:
+			struct pending {
+				cl_mem buffer;
+				size_t class_size;
+				cl_event ev_done;
+				cl_event ev_command; ///< decides whether acquire may wait for "ev_done"
+			};
+
+			cl_mem_flags flags;
+			std::map<size_t, std::vector<cl_mem>> free_buffers;
+			std::vector<pending> in_flight; // oldest first
+
+			void reclaim() {
+				auto done = std::remove_if(in_flight.begin(), in_flight.end(), [this](const pending& p) {
+					cl_int status = CL_QUEUED;
+					clGetEventInfo(p.ev_done, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, nullptr);
+					if(status > CL_COMPLETE) return false;
+					// buffers of failed commands are safe to reuse as well
+					clReleaseEvent(p.ev_done);
+					clReleaseEvent(p.ev_command);
+					free_buffers[p.class_size].push_back(p.buffer);
+					return true;
+				});
+				in_flight.erase(done, in_flight.end());
+			}
+		};
+
+		/**
+		 * @brief Thread performing the host copies of pinned downloads.
+		 *
+		 * Event callbacks must return promptly, so the callback of a pinned read only posts its copy here. Once the copy is done,
+		 * the worker completes the user event of the download. The thread is started by the first post.
+		 */
+		class unpack_worker {
+		public:
+			unpack_worker() = default;
+			unpack_worker(const unpack_worker&) = delete;
+			unpack_worker& operator=(const unpack_worker&) = delete;
+
+			~unpack_worker() {
+				stop();
+			}
+
+			/// Performs "copy" unless "status" reports a failed read, then sets "status" on "ev_done" and releases it.
+			void post(const host::box_copy& copy, cl_event ev_done, cl_int status) {
+				std::lock_guard<std::mutex> lock(mutex);
+				jobs.push_back({ copy, ev_done, status });
+				if(!thread.joinable()) thread = std::thread(&unpack_worker::run, this);
+				wake.notify_one();
+			}
+
+			/// Finishes all posted copies and ends the thread.
+			void stop() {
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if(!thread.joinable()) return;
+					stopping = true;
+					wake.notify_one();
+				}
+				thread.join();
+				stopping = false;
+			}
+
+		private:
+			struct job {
+				host::box_copy copy;
+				cl_event ev_done;
+				cl_int status;
+			};
+
+			std::mutex mutex;
+			std::condition_variable wake;
+			std::deque<job> jobs;
+			bool stopping = false;
+			std::thread thread;
+
+			void run() {
+				std::unique_lock<std::mutex> lock(mutex);
+				for(;;) {
+					wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+					if(jobs.empty()) return;
+					const job j = jobs.front();
+					jobs.pop_front();
+					lock.unlock();
+					if(j.status == CL_COMPLETE) host::copy(j.copy);
+					clSetUserEventStatus(j.ev_done, j.status);
+					clReleaseEvent(j.ev_done);
+					lock.lock();
 				}
+			}
+		};
+
+		/// Large Kernel transfers are split into chunks with their own staging buffers, see set_pipelining.
+		struct pipeline_config {
+			size_t min_bytes = 0; ///< 0 disables pipelining
+			size_t chunk_bytes = 0;
+			cl_command_queue copy_queue = nullptr;
+		};
+
+		enum class kernel_id { Upload2D, Download2D, Upload3D, Download3D, UploadTiled2D, DownloadTiled2D, UploadVec, DownloadVec, UploadBatch, DownloadBatch, Scatter, Gather, Copy3D };
+		constexpr int NUM_KERNEL_IDS = 13;
+
+		/// Programs and kernels built for one element type, indexed by kernel_id.
+		struct transfer_kernel_set {
+			std::shared_future<cl_program> programs[2]; ///< all scalar and all vectorized kernels, possibly still building
+			cl_kernel kernels[NUM_KERNEL_IDS] = {};
+			cl_uint vector_width = 0;      ///< scalars per work-item of the vectorized kernels, 0 if not yet queried
+			cl_uint vector_components = 0; ///< scalars per element
+		};
+
+		/**
+		 * @brief One instance of the library for a context and device: its kernels, staging buffers, cost model and settings.
+		 *
+		 * Instances of different devices share nothing, so they can be used from different threads at the same time; a single
+		 * instance must only be used by one thread at a time.
+		 */
+		class cl_rul_context {
+		public:
+			cl_rul_context(cl_context ctx, cl_device_id device) : cl_ctx(ctx), cl_device(device) {
+				cl_bool unified = CL_FALSE;
+				clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unified, nullptr);
+				host_unified = unified == CL_TRUE;
+			}
+			cl_rul_context(const cl_rul_context&) = delete;
+			cl_rul_context& operator=(const cl_rul_context&) = delete;
+
+			~cl_rul_context() {
+				reset();
+			}
 
-				// FIXME: This doesn't reset user provided types!
-				#define BUF_TYPE(_htype, _dtype) reset_kernel<_htype>();
-				#include "buffer_types.inc"
-				#undef BUF_TYPE
+			/// Releases all OpenCL resources held by the instance and restores the default settings.
+			void reset() {
+				costs = cost_model::defaults();
+				upload_tuner.reset();
+				download_tuner.reset();
+				copy_tuner.reset();
+				staging.reset();
+				reset_pinned_staging();
+				pipelining = {};
+
+				for(auto& kv : kernel_sets) {
+					for(cl_kernel kernel : kv.second.kernels) {
+						if(kernel != nullptr) clReleaseKernel(kernel);
+					}
+					// waits for builds still running in the background
+					for(std::shared_future<cl_program>& program : kv.second.programs) {
+						if(program.valid()) clReleaseProgram(program.get());
+					}
+				}
+				kernel_sets.clear();
 			}
 
 			cl_context get_cl_context() const {
-				assert(cl_ctx && "cl_rect_update_lib - request global CL context before setting it -- did you call init_rect_update_lib?");
 				return cl_ctx;
 			}
 			cl_device_id get_cl_device_id() const {
-				assert(cl_device && "cl_rect_update_lib - request global CL device before setting it -- did you call init_rect_update_lib?");
 				return cl_device;
 			}
 
-			cl_mem get_staging_buffer(size_t size_in_bytes) {
-				//printf("cl_rect_update_lib - requesting staging buffer of size %u, available: %u at %p\n", (unsigned)size_in_bytes, (unsigned)staging_buffer_size, staging_buffer);
-				if(staging_buffer_size < size_in_bytes) {
-					if(staging_buffer != nullptr) clReleaseMemObject(staging_buffer);
-					cl_int errcode = CL_SUCCESS;
-					staging_buffer = clCreateBuffer(get_cl_context(), CL_MEM_READ_WRITE, size_in_bytes, nullptr, &errcode);
-					CLU_ERRCHECK(errcode, "cl_rect_update_lib - error allocating staging buffer of size %u", (unsigned)size_in_bytes);
-					//printf("cl_rect_update_lib - (re-)allocated staging buffer of size %u at %p\n", (unsigned)size_in_bytes, staging_buffer);
-					staging_buffer_size = size_in_bytes;
+			/// True if the device shares physical memory with the host (CPU devices and integrated GPUs).
+			bool is_host_unified() const {
+				return host_unified;
+			}
+
+			/// Hands out a staging buffer of at least "size_in_bytes", which must be given back with release_staging_buffer.
+			cl_mem acquire_staging_buffer(size_t size_in_bytes) {
+				return staging.acquire(get_cl_context(), size_in_bytes);
+			}
+			/// Returns a staging buffer to the pool once "ev_done", the last command using it, has completed.
+			void release_staging_buffer(cl_mem buffer, cl_event ev_done) {
+				staging.release(buffer, ev_done);
+			}
+
+			bool get_pinned_staging() const {
+				return use_pinned_staging;
+			}
+			void set_pinned_staging(bool enable) {
+				use_pinned_staging = enable;
+			}
+
+			/// Hands out page-locked host memory of at least "size_in_bytes", backed by "out_buffer" which stays mapped
+			/// for the lifetime of the library. It must be given back with release_pinned_staging_buffer.
+			void* acquire_pinned_staging_buffer(size_t size_in_bytes, cl_mem& out_buffer) {
+				out_buffer = pinned.acquire(get_cl_context(), size_in_bytes);
+				auto it = pinned_mappings.find(out_buffer);
+				if(it != pinned_mappings.end()) return it->second.host_ptr;
+
+				cl_int errcode = CL_SUCCESS;
+				if(map_queue == nullptr) {
+					map_queue = clCreateCommandQueue(get_cl_context(), get_cl_device_id(), 0, &errcode);
+					CLU_ERRCHECK(errcode, "cl_rect_update_lib - error creating queue for pinned staging buffers");
 				}
-				return staging_buffer;
+				const size_t size = staging_pool::size_class(size_in_bytes);
+				void* host_ptr = clEnqueueMapBuffer(map_queue, out_buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size, 0, NULL, NULL, &errcode);
+				CLU_ERRCHECK(errcode, "cl_rect_update_lib - error mapping pinned staging buffer of size %u", (unsigned)size);
+				pinned_mappings[out_buffer] = { host_ptr, size };
+				return host_ptr;
+			}
+			/// See staging_pool::release for "ev_command".
+			void release_pinned_staging_buffer(cl_mem buffer, cl_event ev_done, cl_event ev_command = nullptr) {
+				pinned.release(buffer, ev_done, ev_command);
 			}
 
-			template<typename T>
-			cl_program& upload_program_2D();
+			/// True if "host_ptr" points into one of the pinned staging buffers.
+			bool is_pinned(const void* host_ptr) const {
+				const char* p = static_cast<const char*>(host_ptr);
+				for(const auto& kv : pinned_mappings) {
+					const char* begin = static_cast<const char*>(kv.second.host_ptr);
+					if(p >= begin && p < begin + kv.second.size) return true;
+				}
+				return false;
+			}
 
-			template<typename T>
-			cl_kernel& upload_kernel_2D();
+			const pipeline_config& get_pipelining() const {
+				return pipelining;
+			}
+			void set_pipelining(const pipeline_config& config) {
+				pipelining = config;
+			}
 
-			template<typename T>
-			cl_program& download_program_2D();
+			const cost_model& get_cost_model() const {
+				return costs;
+			}
+			void set_cost_model(const cost_model& model) {
+				costs = model;
+			}
+
+			runtime_tuner& get_upload_tuner() {
+				return upload_tuner;
+			}
+			runtime_tuner& get_download_tuner() {
+				return download_tuner;
+			}
+			runtime_tuner& get_copy_tuner() {
+				return copy_tuner;
+			}
+
+			unpack_worker& get_unpack_worker() {
+				return unpacker;
+			}
 
+			/// Kernels for T, shared by all types of the same size (see get_type_info).
 			template<typename T>
-			cl_kernel& download_kernel_2D();
+			transfer_kernel_set& transfer_kernels();
 
 		private:
 			cl_context cl_ctx = nullptr;
 			cl_device_id cl_device = nullptr;
-			cl_mem staging_buffer = nullptr;
-			size_t staging_buffer_size = 0;
-
-			template<typename T>
-			void reset_kernel() {
-				if(upload_program_2D<T>() != nullptr) clReleaseProgram(upload_program_2D<T>());
-				if(upload_kernel_2D<T>() != nullptr) clReleaseKernel(upload_kernel_2D<T>());
-				if(download_program_2D<T>() != nullptr) clReleaseProgram(download_program_2D<T>());
-				if(download_kernel_2D<T>() != nullptr) clReleaseKernel(download_kernel_2D<T>());
-				upload_program_2D<T>() = nullptr;
-				upload_kernel_2D<T>() = nullptr;
-				download_program_2D<T>() = nullptr;
-				download_kernel_2D<T>() = nullptr;
+			bool host_unified = false;
+			staging_pool staging;
+			staging_pool pinned { CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR };
+			bool use_pinned_staging = false;
+			struct pinned_mapping {
+				void* host_ptr;
+				size_t size;
+			};
+			std::map<cl_mem, pinned_mapping> pinned_mappings;
+			cl_command_queue map_queue = nullptr;
+			pipeline_config pipelining;
+			cost_model costs = cost_model::defaults();
+			runtime_tuner upload_tuner;
+			runtime_tuner download_tuner;
+			runtime_tuner copy_tuner;
+			std::map<size_t, transfer_kernel_set> kernel_sets;
+			unpack_worker unpacker;
+
+			void reset_pinned_staging() {
+				pinned.wait_idle();
+				unpacker.stop();
+				for(const auto& kv : pinned_mappings) clEnqueueUnmapMemObject(map_queue, kv.first, kv.second.host_ptr, 0, NULL, NULL);
+				pinned_mappings.clear();
+				if(map_queue != nullptr) {
+					clFinish(map_queue);
+					clReleaseCommandQueue(map_queue);
+					map_queue = nullptr;
+				}
+				pinned.reset();
+				use_pinned_staging = false;
 			}
 		};
 
-		#define BODY_PROGRAM { static cl_program prog = nullptr; return prog; }
-		#define BODY_KERNEL { static cl_kernel kernel = nullptr; return kernel; }
+		/**
+		 * @brief The library instances, one per context and device, created on first use.
+		 *
+		 * The lock only guards the lookup, transfers on different devices run concurrently. Instances stay at the same address
+		 * until they are removed, so a reference to one may be kept for the duration of a transfer.
+		 */
+		class instance_registry {
+		public:
+			instance_registry() = default;
+			instance_registry(const instance_registry&) = delete;
+			instance_registry& operator=(const instance_registry&) = delete;
+
+			/// Runs during static destruction, when the OpenCL runtime may already be unloaded, so the instances left are
+			/// leaked rather than released. Call reset_rect_update_lib before exit to release them.
+			~instance_registry() {
+				for(auto& kv : instances) kv.second.release();
+			}
+
+			cl_rul_context& get(cl_context ctx, cl_device_id device) {
+				std::lock_guard<std::mutex> lock(mutex);
+				std::unique_ptr<cl_rul_context>& instance = instances[{ ctx, device }];
+				if(!instance) {
+					instance.reset(new cl_rul_context(ctx, device));
+					if(instances.size() == 1) default_key = { ctx, device };
+				}
+				return *instance;
+			}
 
-		// Provide default implementation for user-defined types.
-		// This means that kernels for user-defined types are local to each translation unit.
-		// Unfortunately there currently is no way (afaik) around this.
-		template<typename T> cl_program& cl_rul_context::upload_program_2D() BODY_PROGRAM;
-		template<typename T> cl_kernel& cl_rul_context::upload_kernel_2D() BODY_KERNEL;
-		template<typename T> cl_program& cl_rul_context::download_program_2D() BODY_PROGRAM;
-		template<typename T> cl_kernel& cl_rul_context::download_kernel_2D() BODY_KERNEL;
+			/// The instance created first, used by the functions which take no queue. It moves on to the oldest remaining
+			/// instance once removed.
+			cl_rul_context& get_default() {
+				std::lock_guard<std::mutex> lock(mutex);
+				auto it = instances.find(default_key);
+				assert(it != instances.end() && "cl_rect_update_lib - no library instance -- did you call init_rect_update_lib?");
+				return *it->second;
+			}
 
-		// Mark all predefined types as external, so the kernels can be shared across translation units.
-		#define BUF_TYPE(_htype, _dtype) template<> CL_RUL_GLOBAL_STORAGE cl_program& cl_rul_context::upload_program_2D<_htype>();
-		#include "buffer_types.inc"
-		#undef BUF_TYPE
+			void remove(cl_context ctx, cl_device_id device) {
+				std::lock_guard<std::mutex> lock(mutex);
+				instances.erase({ ctx, device });
+				if(!instances.empty() && instances.find(default_key) == instances.end()) default_key = instances.begin()->first;
+			}
 
-		#define BUF_TYPE(_htype, _dtype) template<> CL_RUL_GLOBAL_STORAGE cl_kernel& cl_rul_context::upload_kernel_2D<_htype>();
-		#include "buffer_types.inc"
-		#undef BUF_TYPE
+			void clear() {
+				std::lock_guard<std::mutex> lock(mutex);
+				instances.clear();
+			}
 
-		#define BUF_TYPE(_htype, _dtype) template<> CL_RUL_GLOBAL_STORAGE cl_program& cl_rul_context::download_program_2D<_htype>();
-		#include "buffer_types.inc"
-		#undef BUF_TYPE
+			/// Directory of the kernel binary cache shared by all instances, empty if the cache is disabled.
+			std::string get_kernel_cache_directory() {
+				std::lock_guard<std::mutex> lock(mutex);
+				return kernel_cache_directory;
+			}
+			void set_kernel_cache_directory(const std::string& directory) {
+				std::lock_guard<std::mutex> lock(mutex);
+				kernel_cache_directory = directory;
+			}
 
-		#define BUF_TYPE(_htype, _dtype) template<> CL_RUL_GLOBAL_STORAGE cl_kernel& cl_rul_context::download_kernel_2D<_htype>();
-		#include "buffer_types.inc"
-		#undef BUF_TYPE
+		private:
+			typedef std::pair<cl_context, cl_device_id> instance_key;
+			std::mutex mutex;
+			std::map<instance_key, std::unique_ptr<cl_rul_context>> instances;
+			instance_key default_key = { nullptr, nullptr };
+			std::string kernel_cache_directory;
+		};
 
-		extern CL_RUL_GLOBAL_STORAGE cl_rul_context g_context;
+		extern CL_RUL_GLOBAL_STORAGE instance_registry g_instances;
 
 #ifdef CL_RUL_IMPL
-		cl_rul_context g_context;
+		instance_registry g_instances;
+#endif
+
+		/// The library instance for the context and device of "queue". Takes two queue queries and the registry lock, so the
+		/// public functions look it up once and pass it down to the transfer helpers.
+		inline cl_rul_context& instance_of(cl_command_queue queue) {
+			cl_context ctx;
+			clGetCommandQueueInfo(queue, CL_QUEUE_CONTEXT, sizeof(cl_context), &ctx, nullptr);
+			cl_device_id device;
+			clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device, nullptr);
+			return g_instances.get(ctx, device);
+		}
+
+		struct kernel_source {
+			const char* source;
+			const char* name;
+			bool vectorized; ///< built for the scalar type underlying the element type
+		};
+
+		inline const kernel_source& get_kernel_source(kernel_id id) {
+			static const kernel_source sources[NUM_KERNEL_IDS] = {
+				{ kernels::upload_2D, "upload_2D", false },
+				{ kernels::download_2D, "download_2D", false },
+				{ kernels::upload_3D, "upload_3D", false },
+				{ kernels::download_3D, "download_3D", false },
+				{ kernels::upload_tiled_2D, "upload_tiled_2D", false },
+				{ kernels::download_tiled_2D, "download_tiled_2D", false },
+				{ kernels::upload_vec, "upload_vec", true },
+				{ kernels::download_vec, "download_vec", true },
+				{ kernels::upload_batch, "upload_batch", false },
+				{ kernels::download_batch, "download_batch", false },
+				{ kernels::scatter, "scatter", false },
+				{ kernels::gather, "gather", false },
+				{ kernels::copy_3D, "copy_3D", false },
+			};
+			return sources[static_cast<int>(id)];
+		}
 
-		#define BUF_TYPE(_htype, _dtype) template<> CL_RUL_GLOBAL_STORAGE cl_program& cl_rul_context::upload_program_2D<_htype>() BODY_PROGRAM;
-		#include "buffer_types.inc"
-		#undef BUF_TYPE
+		inline std::string concat_kernel_sources(bool vectorized) {
+			std::string ret;
+			for(int k = 0; k < NUM_KERNEL_IDS; ++k) {
+				const kernel_source& src = get_kernel_source(static_cast<kernel_id>(k));
+				if(src.vectorized == vectorized) ret += src.source;
+			}
+			return ret;
+		}
 
-		#define BUF_TYPE(_htype, _dtype) template<> CL_RUL_GLOBAL_STORAGE cl_kernel& cl_rul_context::upload_kernel_2D<_htype>() BODY_KERNEL;
-		#include "buffer_types.inc"
-		#undef BUF_TYPE
+		/// Source of the program holding all scalar or all vectorized kernels, which are built with the same options.
+		inline const std::string& get_program_source(bool vectorized) {
+			static const std::string sources[2] = { concat_kernel_sources(false), concat_kernel_sources(true) };
+			return sources[vectorized ? 1 : 0];
+		}
 
-		#define BUF_TYPE(_htype, _dtype) template<> CL_RUL_GLOBAL_STORAGE cl_program& cl_rul_context::download_program_2D<_htype>() BODY_PROGRAM;
-		#include "buffer_types.inc"
-		#undef BUF_TYPE
+		/// True if the box covers a single contiguous range of the buffer (a partial row, full rows or full slices).
+		inline bool is_linear(const Extent& full_e, const Box& box) {
+			const Extent& e = box.extent;
+			if(e.ys == 1 && e.zs == 1) return true;
+			return e.xs == full_e.xs && (e.zs == 1 || e.ys == full_e.ys);
+		}
 
-		#define BUF_TYPE(_htype, _dtype) template<> CL_RUL_GLOBAL_STORAGE cl_kernel& cl_rul_context::download_kernel_2D<_htype>() BODY_KERNEL;
-		#include "buffer_types.inc"
-		#undef BUF_TYPE
+		inline method_id select_method(const transfer_costs& costs, const Box& box, size_t element_size) {
+			const size_t rows = box.extent.ys * box.extent.zs;
+			const size_t bytes = box.size() * element_size;
+			const double individual = costs.individual.estimate(rows, bytes);
+			const double clrect = costs.clrect.estimate(rows, bytes);
+			const double kernel = costs.kernel.estimate(rows, bytes);
+			if(kernel <= clrect && kernel <= individual) return method_id::Kernel;
+			return clrect <= individual ? method_id::ClRect : method_id::Individual;
+		}
 
-#endif
+		/// Hands "ev" to the caller if it asked for an event, otherwise releases it. A user event (completed by the unpack worker of
+		/// a pinned download) is joined into "queue" first, so the transfer is still done once the queue has been finished.
+		inline cl_event return_event(cl_command_queue queue, cl_event ev, bool want_event) {
+			if(want_event || ev == nullptr) return ev;
+			cl_command_type type = 0;
+			clGetEventInfo(ev, CL_EVENT_COMMAND_TYPE, sizeof(type), &type, nullptr);
+			if(type == CL_COMMAND_USER) {
+				cl_int errcode = clEnqueueMarkerWithWaitList(queue, 1, &ev, NULL);
+				CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing completion marker");
+			}
+			clReleaseEvent(ev);
+			return nullptr;
+		}
 
-		#undef BODY_PROGRAM
-		#undef BODY_KERNEL
+		inline bool is_out_of_order(cl_command_queue queue) {
+			cl_command_queue_properties props = 0;
+			clGetCommandQueueInfo(queue, CL_QUEUE_PROPERTIES, sizeof(props), &props, nullptr);
+			return (props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) != 0;
+		}
 
-		constexpr const char* UPLOAD_2D_KERNEL_NAME = "upload_2D";
-		constexpr const char* DOWNLOAD_2D_KERNEL_NAME = "download_2D";
+		inline bool has_profiling(cl_command_queue queue) {
+			cl_command_queue_properties props = 0;
+			clGetCommandQueueInfo(queue, CL_QUEUE_PROPERTIES, sizeof(props), &props, nullptr);
+			return (props & CL_QUEUE_PROFILING_ENABLE) != 0;
+		}
 
-		inline void check_global_state_validity(cl_command_queue queue) {
-			cl_context local_ctx;
-			clGetCommandQueueInfo(queue, CL_QUEUE_CONTEXT, sizeof(cl_context), &local_ctx, nullptr);
-			assert(local_ctx == g_context.get_cl_context());
-			cl_device_id local_dev;
-			clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(cl_device_id), &local_dev, nullptr);
-			assert(local_dev == g_context.get_cl_device_id());
+		/// Runs "transfer" with the method chosen by "tuner", timing it if the bucket is still exploring.
+		/// The start marker waits for the wait list of the transfer, so time spent waiting for it is not attributed to the method.
+		template<typename Transfer>
+		cl_event tuned_transfer(cl_command_queue queue, runtime_tuner& tuner, const transfer_costs& costs, const Box& box, size_t element_size, const WaitList& wait, bool want_event, Transfer transfer) {
+			const method_id fallback = select_method(costs, box, element_size);
+			const tuning_key key = make_tuning_key(box, element_size);
+
+			method_id converged;
+			if(tuner.converged(key, converged)) return transfer(converged, want_event);
+			if(!has_profiling(queue)) return transfer(fallback, want_event);
+
+			const size_t rows = box.extent.ys * box.extent.zs;
+			const size_t bytes = box.size() * element_size;
+			const double estimates[NUM_METHOD_IDS] = { costs.individual.estimate(rows, bytes), costs.clrect.estimate(rows, bytes), costs.kernel.estimate(rows, bytes) };
+			const double best_estimate = estimates[static_cast<int>(fallback)];
+			bool candidates[NUM_METHOD_IDS];
+			for(int m = 0; m < NUM_METHOD_IDS; ++m) candidates[m] = estimates[m] <= best_estimate * RUNTIME_CANDIDATE_FACTOR;
+
+			runtime_tuner::choice c = tuner.choose(key, fallback, candidates);
+			if(!c.sample) return transfer(c.method, want_event);
+
+			cl_event ev_start;
+			cl_int errcode = clEnqueueMarkerWithWaitList(queue, wait.count, wait.events, &ev_start);
+			CLU_ERRCHECK(errcode, "cl_rect_update_lib - error enqueueing runtime tuning marker");
+			// a sample needs the event even if the caller does not
+			cl_event ev_ret = transfer(c.method, true);
+			if(ev_ret == nullptr) {
+				clReleaseEvent(ev_start);
+				return ev_ret;
+			}
+			clRetainEvent(ev_ret);
+			tuner.record(key, c.method, ev_start, ev_ret);
+			return return_event(queue, ev_ret, want_event);
 		}
 
 		struct type_info {
@@ -204,241 +1016,735 @@ namespace cl_rul {
 			int num;
 		};
 
+		/// Device type the kernels copy elements of T with: "num" of the widest unsigned word (up to 16 bytes) dividing sizeof(T).
+		/// Elements lie at multiples of their size in a buffer, so these words are always naturally aligned. A copy only depends on
+		/// the size, so all types of one size share their kernels, and the bits are moved unchanged (no float canonicalization).
 		template<typename T>
 		const type_info get_type_info() {
 			int s = sizeof(T);
-			if(s % 16 == 0) return { "float4", s / 16 };
-			if(s %  8 == 0) return { "float2", s /  8 };
-			if(s %  4 == 0) return {  "float", s /  4 };
-			return { "char", s };
+			if(s % 16 == 0) return { "uint4", s / 16 };
+			if(s %  8 == 0) return { "uint2", s /  8 };
+			if(s %  4 == 0) return {  "uint", s /  4 };
+			if(s %  2 == 0) return { "ushort", s / 2 };
+			return { "uchar", s };
 		}
 
-		#define BUF_TYPE(_htype, _dtype) template<> inline const type_info get_type_info<_htype>() { return {#_dtype, 1}; }
-		#include "buffer_types.inc"
-		#undef BUF_TYPE
-
 		template<typename T>
-		void build_transfer_kernel(const char* source, const char* kernel_name, cl_program& out_prog, cl_kernel& out_kernel) {
-			auto ti = get_type_info<T>();
-			std::stringstream ss;
-			ss << "-D T=" << ti.name << " " << "-D NUM=" << ti.num << std::flush;
-			std::string options = ss.str();
-			//printf("options: \"%s\"\n", options.c_str());
-			out_prog = cluBuildProgramFromString(g_context.get_cl_context(), g_context.get_cl_device_id(), source, options.c_str());
-			cl_int errcode = CL_SUCCESS;
-			out_kernel = clCreateKernel(out_prog, kernel_name, &errcode);
-			CLU_ERRCHECK(errcode, "cl_rect_update_lib - kernel loading error for options: %s", options.c_str());
+		transfer_kernel_set& cl_rul_context::transfer_kernels() {
+			return kernel_sets[sizeof(T)]; // value-initialized, so all kernels are null
+		}
+
+		/// Splits a device type name such as "uchar4" into its scalar type and the number of scalars.
+		inline std::string scalar_type_name(const std::string& name, int& components) {
+			const size_t digits = name.find_first_of("0123456789");
+			components = digits == std::string::npos ? 1 : std::stoi(name.substr(digits));
+			return name.substr(0, digits);
 		}
 
+		inline cl_device_info preferred_vector_width_param(const std::string& scalar) {
+			const std::string base = scalar[0] == 'u' ? scalar.substr(1) : scalar;
+			if(base == "char") return CL_DEVICE_PREFERRED_VECTOR_WIDTH_CHAR;
+			if(base == "short") return CL_DEVICE_PREFERRED_VECTOR_WIDTH_SHORT;
+			if(base == "int") return CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT;
+			if(base == "long") return CL_DEVICE_PREFERRED_VECTOR_WIDTH_LONG;
+			if(base == "double") return CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE;
+			return CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT;
+		}
+
+		/// Minimum number of bytes a work-item of the vectorized kernels should move, devices commonly report a
+		/// preferred width of 1 even for chars.
+		constexpr size_t MIN_VECTOR_BYTES = 4;
+		constexpr cl_uint MAX_VECTOR_WIDTH = 16;
+
+		/// Vector width for T: the device's preferred width for the underlying scalar type, raised to MIN_VECTOR_BYTES
+		/// and rounded down to a power of two. Vectorized kernels are only used if this moves more than one element.
 		template<typename T>
-		cl_kernel get_upload_kernel_2D() {
-			if(!g_context.upload_kernel_2D<T>()) {
-				build_transfer_kernel<T>(kernels::upload_2D, UPLOAD_2D_KERNEL_NAME, g_context.upload_program_2D<T>(), g_context.upload_kernel_2D<T>());
+		cl_uint get_vector_width(cl_rul_context& lib, cl_uint& components) {
+			transfer_kernel_set& set = lib.transfer_kernels<T>();
+			if(set.vector_width == 0) {
+				auto ti = get_type_info<T>();
+				int scalar_components;
+				const std::string scalar = scalar_type_name(ti.name, scalar_components);
+				set.vector_components = static_cast<cl_uint>(scalar_components * ti.num);
+				const size_t scalar_size = sizeof(T) / set.vector_components;
+
+				cl_uint preferred = 0;
+				cl_int errcode = clGetDeviceInfo(lib.get_cl_device_id(), preferred_vector_width_param(scalar), sizeof(cl_uint), &preferred, nullptr);
+				CLU_ERRCHECK(errcode, "cl_rect_update_lib - error querying preferred vector width");
+				// a preferred width of 0 means the type is unsupported (e.g. double without fp64)
+				const cl_uint wanted = preferred == 0 ? 1 : std::max(preferred, static_cast<cl_uint>(MIN_VECTOR_BYTES / scalar_size));
+				cl_uint width = 1;
+				while(width * 2 <= std::min(wanted, MAX_VECTOR_WIDTH)) width *= 2;
+				set.vector_width = width;
 			}
-			return g_context.upload_kernel_2D<T>();
+			components = set.vector_components;
+			return set.vector_width;
+		}
+
+		template<typename T>
+		bool has_vector_kernels(cl_rul_context& lib) {
+			cl_uint components;
+			return get_vector_width<T>(lib, components) > components;
 		}
 
 		template<typename T>
-		cl_kernel get_download_kernel_2D() {
-			if(!g_context.download_kernel_2D<T>()) {
-				build_transfer_kernel<T>(kernels::download_2D, DOWNLOAD_2D_KERNEL_NAME, g_context.download_program_2D<T>(), g_context.download_kernel_2D<T>());
+		std::string transfer_kernel_options(cl_rul_context& lib, bool vectorized) {
+			auto ti = get_type_info<T>();
+			std::stringstream ss;
+			if(vectorized) {
+				int scalar_components;
+				cl_uint components;
+				ss << "-D T=" << scalar_type_name(ti.name, scalar_components) << " " << "-D VEC=" << get_vector_width<T>(lib, components) << std::flush;
+			} else {
+				ss << "-D T=" << ti.name << " " << "-D NUM=" << ti.num << std::flush;
 			}
-			return g_context.download_kernel_2D<T>();
+			return ss.str();
 		}
 
-	} // namespace detail
+		/// 64 bit FNV-1a, names the files of the kernel binary cache.
+		inline uint64_t hash_string(const std::string& str) {
+			uint64_t hash = 14695981039346656037ull;
+			for(unsigned char c : str) {
+				hash ^= c;
+				hash *= 1099511628211ull;
+			}
+			return hash;
+		}
 
-	/**
-	 * @brief Initializes the cl_rect_update library. This must be called before using any of the other methods.
-	 *
-	 * @param eager If true, transfer kernels for all predefined types will be compiled immediately, instead of when they're first required.
-	 */
-	inline void init_rect_update_lib(cl_context context, cl_device_id device, bool eager = false) {
-		detail::g_context.initialize(context, device);
+		inline std::string device_info_string(cl_device_id device, cl_device_info param) {
+			size_t size = 0;
+			clGetDeviceInfo(device, param, 0, nullptr, &size);
+			std::string ret(size, '\0');
+			if(size > 0) clGetDeviceInfo(device, param, size, &ret[0], nullptr);
+			return ret;
+		}
 
-		if (eager) {
-			// TODO make pre-compilation configurable? could take some time
-			#define BUF_TYPE(_htype, _dtype) detail::get_upload_kernel_2D<_htype>();
-			#include "buffer_types.inc"
-			#undef BUF_TYPE
+		/// Identifies the binary of "source" built with "options" for "device". It hashes the device, its driver version, the
+		/// options and the source, so a driver update or a changed kernel never loads a stale binary.
+		inline uint64_t kernel_binary_key(cl_device_id device, const char* source, const std::string& options) {
+			const std::string key = device_info_string(device, CL_DEVICE_VENDOR) + '\n' + device_info_string(device, CL_DEVICE_NAME) + '\n'
+				+ device_info_string(device, CL_DEVICE_VERSION) + '\n' + device_info_string(device, CL_DRIVER_VERSION) + '\n' + options + '\n' + source;
+			return hash_string(key);
+		}
 
-			#define BUF_TYPE(_htype, _dtype) detail::get_download_kernel_2D<_htype>();
-			#include "buffer_types.inc"
-			#undef BUF_TYPE
+		/// File in "directory" holding the binary of "source" built with "options" for "device", named by its kernel_binary_key.
+		inline std::string kernel_cache_path(const std::string& directory, cl_device_id device, const char* source, const std::string& options) {
+			std::stringstream ss;
+			ss << directory << "/cl_rul_" << std::hex << std::setw(16) << std::setfill('0') << kernel_binary_key(device, source, options) << ".bin";
+			return ss.str();
 		}
-	}
 
-	inline void reset_rect_update_lib() {
-		detail::g_context.reset();
-	}
+		/// Builds a program from a binary obtained by get_program_binary. Returns nullptr if it fails to build.
+		inline cl_program build_program_from_binary(cl_context ctx, cl_device_id device, const unsigned char* data, size_t size, const std::string& options) {
+			cl_int status = CL_SUCCESS, errcode = CL_SUCCESS;
+			cl_program program = clCreateProgramWithBinary(ctx, 1, &device, &size, &data, &status, &errcode);
+			if(errcode != CL_SUCCESS) return nullptr;
+			if(status != CL_SUCCESS || clBuildProgram(program, 1, &device, options.c_str(), NULL, NULL) != CL_SUCCESS) {
+				clReleaseProgram(program);
+				return nullptr;
+			}
+			return program;
+		}
 
-	/// Upload functions ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		/// Builds a program from a binary stored by save_program_binary. Returns nullptr if there is none or it fails to build.
+		inline cl_program load_program_binary(cl_context ctx, cl_device_id device, const std::string& path, const std::string& options) {
+			std::ifstream file(path, std::ios::binary);
+			if(!file) return nullptr;
+			const std::vector<unsigned char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+			if(binary.empty()) return nullptr;
+			return build_program_from_binary(ctx, device, binary.data(), binary.size(), options);
+		}
 
-	// Update methods (tag type dispatch)
-	class Individual {};
-	class ClRect {};
-	class Kernel {};
-	class Automatic {};
-	class Runtime {};
+		/// Binary of "program" for "device", empty if the driver does not provide one.
+		inline std::vector<unsigned char> get_program_binary(cl_program program, cl_device_id device) {
+			cl_uint num_devices = 0;
+			if(clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(cl_uint), &num_devices, nullptr) != CL_SUCCESS || num_devices == 0) return {};
+			std::vector<cl_device_id> devices(num_devices);
+			clGetProgramInfo(program, CL_PROGRAM_DEVICES, num_devices * sizeof(cl_device_id), devices.data(), nullptr);
+			const size_t index = std::find(devices.begin(), devices.end(), device) - devices.begin();
+			if(index == num_devices) return {};
+
+			// binaries are reported for all devices of the context, only the one the program was built for is non-empty
+			std::vector<size_t> sizes(num_devices);
+			clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, num_devices * sizeof(size_t), sizes.data(), nullptr);
+			if(sizes[index] == 0) return {};
+			std::vector<std::vector<unsigned char>> binaries(num_devices);
+			std::vector<unsigned char*> pointers(num_devices, nullptr);
+			binaries[index].resize(sizes[index]);
+			pointers[index] = binaries[index].data();
+			if(clGetProgramInfo(program, CL_PROGRAM_BINARIES, num_devices * sizeof(unsigned char*), pointers.data(), nullptr) != CL_SUCCESS) return {};
+			return binaries[index];
+		}
 
-	namespace detail {
-		template<typename T, typename Method = Automatic>
-		struct rect_uploader {
-			cl_event operator()(cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *linearized_host_data_source);
+		/// Stores the binary of "program" for "device". It is written to a temporary file first and then renamed, so another
+		/// process never loads a partial binary. Failures only cost a rebuild on the next run and are ignored.
+		inline void save_program_binary(cl_program program, cl_device_id device, const std::string& path) {
+			const std::vector<unsigned char> binary = get_program_binary(program, device);
+			if(binary.empty()) return;
+
+			std::stringstream tmp_path;
+			tmp_path << path << "." << std::hex << hash_string(std::to_string(std::chrono::high_resolution_clock::now().time_since_epoch().count())) << ".tmp";
+			{
+				std::ofstream file(tmp_path.str(), std::ios::binary);
+				if(!file) return;
+				file.write(reinterpret_cast<const char*>(binary.data()), binary.size());
+				if(!file) {
+					file.close();
+					std::remove(tmp_path.str().c_str());
+					return;
+				}
+			}
+			if(std::rename(tmp_path.str().c_str(), path.c_str()) != 0) std::remove(tmp_path.str().c_str());
+		}
+
+#ifdef CL_RUL_EMBEDDED_KERNELS
+		/// Program binary compiled at build time by cl_rul_embed_kernels, see the CL_RUL_EMBED_KERNELS CMake option.
+		struct embedded_program {
+			uint64_t key; // kernel_binary_key of the device, options and source it was built from
+			const unsigned char* binary;
+			size_t size;
 		};
 
-		template<typename T>
-		struct rect_uploader<T, Individual> {
-			cl_event operator()(cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *linearized_host_data_source) {
-				cl_event ev_ret = nullptr;
+		// defined in the source generated for the cl_rect_update_kernels library
+		extern const embedded_program embedded_programs[];
+		extern const size_t num_embedded_programs;
 
-				const Point& o = target_box.origin;
-				const Extent& e = target_box.extent;
-				const Extent& full_e = target_buffer_size;
+		inline cl_program load_embedded_program(cl_context ctx, cl_device_id device, const std::string& source, const std::string& options) {
+			const uint64_t key = kernel_binary_key(device, source.c_str(), options);
+			for(size_t i = 0; i < num_embedded_programs; ++i) {
+				const embedded_program& p = embedded_programs[i];
+				if(p.key == key) return build_program_from_binary(ctx, device, p.binary, p.size, options);
+			}
+			return nullptr;
+		}
+#endif
 
-				const T* source_ptr = linearized_host_data_source;
+		/// Builds a program for "device", loading it from the embedded binaries or the kernel binary cache if possible.
+		inline cl_program build_transfer_program(cl_context ctx, cl_device_id device, const std::string& source, const std::string& options) {
+			//printf("options: \"%s\"\n", options.c_str());
+#ifdef CL_RUL_EMBEDDED_KERNELS
+			if(cl_program program = load_embedded_program(ctx, device, source, options)) return program;
+#endif
+			const std::string cache_directory = g_instances.get_kernel_cache_directory();
+			const std::string cache_path = cache_directory.empty() ? std::string() : kernel_cache_path(cache_directory, device, source.c_str(), options);
+			cl_program program = cache_path.empty() ? nullptr : load_program_binary(ctx, device, cache_path, options);
+			if(program == nullptr) {
+				program = cluBuildProgramFromString(ctx, device, source.c_str(), options.c_str());
+				if(!cache_path.empty()) save_program_binary(program, device, cache_path);
+			}
+			return program;
+		}
 
-				size_t zend = o.z + e.zs;
-				size_t yend = o.y + e.ys;
-				for(size_t z = o.z; z < zend; z++) {
-					for(size_t y = o.y; y < yend; y++) {
-						bool last = z == zend - 1 && y == yend - 1;
-						size_t offset = full_e.row_offset(y, z) + o.x;
-						//printf("cl_rect_update_lib - individual upload offset: %8u ; range: %8u\n", (unsigned)(offset * sizeof(T)), (unsigned)(e.xs * sizeof(T)));
-						cl_int errcode = clEnqueueWriteBuffer(queue, target_buffer, CL_FALSE, offset * sizeof(T), e.xs * sizeof(T), source_ptr, 0, NULL, last ? &ev_ret : NULL);
-						CLU_ERRCHECK(errcode, "cl_rect_update_lib - upload_rect: error enqueueing individual transfer");
-						source_ptr += e.xs;
-					}
-				}
+		/**
+		 * @brief Starts the build of the program holding all scalar (or all vectorized) kernels for T, unless it was started before.
+		 *
+		 * With "async" the build runs on its own thread, otherwise it is deferred to the first wait for the returned future.
+		 * Either way, a transfer only ever waits for the one program its kernel is in.
+		 */
+		template<typename T>
+		const std::shared_future<cl_program>& start_program_build(cl_rul_context& lib, bool vectorized, bool async) {
+			transfer_kernel_set& set = lib.transfer_kernels<T>();
+			std::shared_future<cl_program>& program = set.programs[vectorized ? 1 : 0];
+			if(!program.valid()) {
+				const cl_context ctx = lib.get_cl_context();
+				const cl_device_id device = lib.get_cl_device_id();
+				// the options query the device on this thread, the build thread only uses copies
+				const std::string options = transfer_kernel_options<T>(lib, vectorized);
+				const std::string& source = get_program_source(vectorized);
+				program = std::async(async ? std::launch::async : std::launch::deferred, [ctx, device, &source, options] {
+					return build_transfer_program(ctx, device, source, options);
+				}).share();
+			}
+			return program;
+		}
 
-				return ev_ret;
+		template<typename T>
+		cl_kernel get_transfer_kernel(cl_rul_context& lib, kernel_id id) {
+			transfer_kernel_set& set = lib.transfer_kernels<T>();
+			const int k = static_cast<int>(id);
+			if(!set.kernels[k]) {
+				const kernel_source& src = get_kernel_source(id);
+				assert((!src.vectorized || has_vector_kernels<T>(lib)) && "cl_rect_update_lib - vectorized kernel requested for a type without vector width");
+				cl_program program = start_program_build<T>(lib, src.vectorized, false).get();
+				cl_int errcode = CL_SUCCESS;
+				set.kernels[k] = clCreateKernel(program, src.name, &errcode);
+				CLU_ERRCHECK(errcode, "cl_rect_update_lib - kernel loading error for options: %s", transfer_kernel_options<T>(lib, src.vectorized).c_str());
 			}
-		};
+			return set.kernels[k];
+		}
 
+		/// Starts building the programs of all kernels for T in the background, see start_program_build.
 		template<typename T>
-		struct rect_uploader<T, ClRect> {
-			cl_event operator()(cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *linearized_host_data_source) {
-				cl_event ev_ret;
+		void start_transfer_kernel_builds(cl_rul_context& lib) {
+			start_program_build<T>(lib, false, true);
+			if(has_vector_kernels<T>(lib)) start_program_build<T>(lib, true, true);
+		}
 
-				const Point& o = target_box.origin;
-				const Extent& e = target_box.extent;
-				const Extent& full_e = target_buffer_size;
+		template<typename T>
+		void build_all_transfer_kernels(cl_rul_context& lib) {
+			for(int k = 0; k < NUM_KERNEL_IDS; ++k) {
+				const kernel_id id = static_cast<kernel_id>(k);
+				if(get_kernel_source(id).vectorized && !has_vector_kernels<T>(lib)) continue;
+				get_transfer_kernel<T>(lib, id);
+			}
+		}
 
-				const size_t buffer_origin[3] = { o.x * sizeof(T), o.y, o.z };
-				const size_t host_origin[3] = { 0, 0, 0 };
-				const size_t region[3] = { e.xs * sizeof(T), e.ys, e.zs };
-				size_t buffer_row_pitch = full_e.xs * sizeof(T);
-				size_t buffer_slice_pitch = full_e.slice_size() * sizeof(T);
-				size_t host_row_pitch = e.xs * sizeof(T);
-				size_t host_slice_pitch = e.slice_size() * sizeof(T);
-				cl_int errcode = clEnqueueWriteBufferRect(queue, target_buffer, CL_FALSE,
-					buffer_origin, host_origin, region,
-					buffer_row_pitch, buffer_slice_pitch, host_row_pitch, host_slice_pitch,
-					linearized_host_data_source, 0, NULL, &ev_ret);
-				CLU_ERRCHECK(errcode, "cl_rect_upate_lib - upload_rect: error enqueueing clrect transfer");
+		inline cost_model measure_cost_model(cl_rul_context& lib);
 
-				return ev_ret;
-			}
+		constexpr size_t TRANSFER_WORK_GROUP_SIZE = 64;
+
+		struct transfer_ndrange {
+			size_t global[3];
+			size_t local[3];
 		};
 
+		/// Launch geometry for the transfer kernels: work-groups of TRANSFER_WORK_GROUP_SIZE items that are as wide as
+		/// the box allows, with the global size padded to full groups (the kernels check bounds).
+		inline transfer_ndrange make_transfer_ndrange(const Extent& e) {
+			size_t local_x = 1;
+			while(local_x < e.xs && local_x < TRANSFER_WORK_GROUP_SIZE) local_x *= 2;
+			const size_t local_y = TRANSFER_WORK_GROUP_SIZE / local_x;
+			auto round_up = [](size_t value, size_t multiple) { return (value + multiple - 1) / multiple * multiple; };
+			return { { round_up(e.xs, local_x), round_up(e.ys, local_y), e.zs }, { local_x, local_y, 1 } };
+		}
+
+		constexpr size_t TILED_ELEMENTS_PER_GROUP = 4 * TRANSFER_WORK_GROUP_SIZE;
+		constexpr size_t NARROW_BOX_RATIO = 8;
+
+		/// Boxes much taller than wide, which are moved by the tiled strip kernels.
+		inline bool is_narrow(const Extent& e) {
+			return e.xs < TRANSFER_WORK_GROUP_SIZE && e.xs * NARROW_BOX_RATIO <= e.ys;
+		}
+
+		/// Enqueues a 2D transfer kernel with its first 7 arguments already set.
+		/// Tiled kernels get their strip height as 8th argument and one work-group per strip.
+		inline cl_int enqueue_transfer_kernel_2D(cl_command_queue queue, cl_kernel kernel, bool tiled, const Extent& e, const WaitList& wait, cl_event* ev_kernel) {
+			if(!tiled) {
+				const transfer_ndrange range = make_transfer_ndrange(e);
+				return clEnqueueNDRangeKernel(queue, kernel, 2, NULL, range.global, range.local, wait.count, wait.events, ev_kernel);
+			}
+			const cl_uint rows_per_group = static_cast<cl_uint>(std::max<size_t>(1, TILED_ELEMENTS_PER_GROUP / e.xs));
+			CLU_ERRCHECK(clSetKernelArg(kernel, 7, sizeof(cl_uint), &rows_per_group), "cl_rect_update_lib - error setting strip height");
+			const size_t local_size = TRANSFER_WORK_GROUP_SIZE;
+			const size_t global_size = (e.ys + rows_per_group - 1) / rows_per_group * local_size;
+			return clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, &local_size, wait.count, wait.events, ev_kernel);
+		}
+
+		/// Rows shorter than this many vectors gain nothing from the vectorized kernels, as most of their slots would be peeled.
+		constexpr size_t MIN_VECTORS_PER_ROW = 4;
+
 		template<typename T>
-		cl_event upload_rect_kernel_2D(cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *linearized_host_data_source) {
+		bool use_vector_kernel(cl_rul_context& lib, const Extent& e) {
+			cl_uint components;
+			const cl_uint width = get_vector_width<T>(lib, components);
+			return width > components && e.xs * components >= MIN_VECTORS_PER_ROW * width;
+		}
 
-			// transfer linearly to staging buffer
+		/// True if the scalar (or vectorized) program for T can be used without waiting for the compiler. Otherwise its build is
+		/// started in the background, and the caller serves the transfer with ClRect until it is ready.
+		template<typename T>
+		bool program_ready(cl_rul_context& lib, bool vectorized) {
+			const std::shared_future<cl_program>& program = start_program_build<T>(lib, vectorized, true);
+			// a deferred (lazy) build is always waited for right after it was started, so it has run already
+			return program.wait_for(std::chrono::seconds(0)) != std::future_status::timeout;
+		}
 
-			size_t required_staging_size = target_box.size() * sizeof(T);
-			cl_mem staging_buffer = g_context.get_staging_buffer(required_staging_size);
-			cl_event ev_staging;
-			cl_int errcode = clEnqueueWriteBuffer(queue, staging_buffer, CL_FALSE, 0, required_staging_size, linearized_host_data_source, 0, NULL, &ev_staging);
-			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing staging transfer");
+		/// True if the kernels of a Kernel transfer of "box" are ready, see program_ready.
+		template<typename T>
+		bool transfer_kernels_ready(cl_rul_context& lib, const Box& box) {
+			return program_ready<T>(lib, use_vector_kernel<T>(lib, box.extent));
+		}
 
-			const Point& o = target_box.origin;
-			const Extent& e = target_box.extent;
-			const Extent& full_e = target_buffer_size;
+		/// Enqueues UploadVec or DownloadVec for a 2D or 3D box, with all x coordinates converted to scalars.
+		/// Every row gets enough slots to cover its unaligned head and tail.
+		template<typename T>
+		cl_event enqueue_vector_kernel(cl_rul_context& lib, cl_command_queue queue, kernel_id id, cl_mem src_buffer, cl_mem trg_buffer, const Extent& buffer_size, const Box& box, const WaitList& wait) {
+			const Point& o = box.origin;
+			const Extent& e = box.extent;
+			const Extent& full_e = buffer_size;
 
-			// use kernel to write to final destination
 			// parameters:
-			//		__global v_t *src, __global v_t *trg,
-			//		uint pos_x, uint pos_y,
-			//		uint size_x, uint size_y,
-			//		uint stride
+			//		__global T *src, __global T *trg,
+			//		uint pos_x, uint pos_y, uint pos_z,
+			//		uint size_x, uint size_y, uint size_z,
+			//		uint stride, uint slice_stride
 
-			cl_kernel kernel = get_upload_kernel_2D<T>();
+			cl_uint components;
+			const cl_uint width = get_vector_width<T>(lib, components);
+			cl_kernel kernel = get_transfer_kernel<T>(lib, id);
 
 			cl_event ev_kernel;
-			cl_uint pos_x = static_cast<cl_uint>(o.x), pos_y = static_cast<cl_uint>(o.y);
-			cl_uint size_x = static_cast<cl_uint>(e.xs), size_y = static_cast<cl_uint>(e.ys);
-			cl_uint stride = static_cast<cl_uint>(full_e.xs);
-			cluSetKernelArguments(kernel, 7,
-				sizeof(cl_mem), &staging_buffer, sizeof(cl_mem), &target_buffer,
-				sizeof(cl_uint), &pos_x, sizeof(cl_uint), &pos_y,
-				sizeof(cl_uint), &size_x, sizeof(cl_uint), &size_y,
-				sizeof(cl_uint), &stride);
-			size_t global_size = target_box.size();
-			errcode = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, 0, 0, NULL, &ev_kernel);
-			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing upload kernel");
+			cl_uint pos_x = static_cast<cl_uint>(o.x * components), pos_y = static_cast<cl_uint>(o.y), pos_z = static_cast<cl_uint>(o.z);
+			cl_uint size_x = static_cast<cl_uint>(e.xs * components), size_y = static_cast<cl_uint>(e.ys), size_z = static_cast<cl_uint>(e.zs);
+			cl_uint stride = static_cast<cl_uint>(full_e.xs * components), slice_stride = static_cast<cl_uint>(full_e.slice_size() * components);
+			cluSetKernelArguments(kernel, 10,
+				sizeof(cl_mem), &src_buffer, sizeof(cl_mem), &trg_buffer,
+				sizeof(cl_uint), &pos_x, sizeof(cl_uint), &pos_y, sizeof(cl_uint), &pos_z,
+				sizeof(cl_uint), &size_x, sizeof(cl_uint), &size_y, sizeof(cl_uint), &size_z,
+				sizeof(cl_uint), &stride, sizeof(cl_uint), &slice_stride);
+			const Extent slots((size_x + 2 * width - 2) / width, e.ys, e.zs);
+			const transfer_ndrange range = make_transfer_ndrange(slots);
+			cl_int errcode = clEnqueueNDRangeKernel(queue, kernel, 3, NULL, range.global, range.local, wait.count, wait.events, &ev_kernel);
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing vectorized transfer kernel");
 
 			return ev_kernel;
 		}
 
-		template<typename T>
-		struct rect_uploader<T, Kernel> {
-			cl_event operator()(cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *linearized_host_data_source) {
-				cl_event ev_ret = nullptr;
-
-				const Extent& s = target_buffer_size;
-				const Point& o = target_box.origin;
-				const Extent& e = target_box.extent;
+		/// Smallest range of a buffer of extent "full_e" that encloses "box", in elements.
+		inline void enclosing_range(const Extent& full_e, const Box& box, size_t& out_offset, size_t& out_count) {
+			const Point& o = box.origin;
+			const Extent& e = box.extent;
+			out_offset = full_e.row_offset(o.y, o.z) + o.x;
+			out_count = full_e.row_offset(o.y + e.ys - 1, o.z + e.zs - 1) + o.x + e.xs - out_offset;
+		}
 
-				// if 1D, just use simple transfer
-				if(e.ys == 1 && e.zs == 1) {
-					const size_t linear_offset = o.z * s.xs * s.ys + o.y * s.xs + o.x;
-					cl_int errcode = clEnqueueWriteBuffer(queue, target_buffer, CL_FALSE, linear_offset * sizeof(T), e.xs * sizeof(T), linearized_host_data_source, 0, NULL, &ev_ret);
-					CLU_ERRCHECK(errcode, "cl_rect_upate_lib - upload_rect: error enqueueing transfer");
-					return ev_ret;
-				}
+		/// Splits "box" into consecutive boxes of whole slices, or of whole rows if it is a single slice, of at most "chunk_bytes"
+		/// each where possible. A slice larger than "chunk_bytes" becomes one chunk.
+		inline std::vector<Box> split_box(const Box& box, size_t element_size, size_t chunk_bytes) {
+			const Point& o = box.origin;
+			const Extent& e = box.extent;
+			std::vector<Box> chunks;
+			if(e.zs > 1) {
+				const size_t step = std::max<size_t>(1, chunk_bytes / (e.slice_size() * element_size));
+				for(size_t z = 0; z < e.zs; z += step) chunks.push_back({ { o.x, o.y, o.z + z }, { e.xs, e.ys, std::min(step, e.zs - z) } });
+			}
+			else {
+				const size_t step = std::max<size_t>(1, chunk_bytes / (e.xs * element_size));
+				for(size_t y = 0; y < e.ys; y += step) chunks.push_back({ { o.x, o.y + y, o.z }, { e.xs, std::min(step, e.ys - y), e.zs } });
+			}
+			return chunks;
+		}
 
-				// if 2D or 3D use linearized transfer and specialized kernel
-				if(e.zs == 1) return upload_rect_kernel_2D<T>(queue, target_buffer, target_buffer_size, target_box, linearized_host_data_source);
+		/// Enqueues a marker which completes once all of "events" (which may belong to other queues) have, and releases them.
+		/// Returns the event of the marker, or nullptr unless "want_event" is set.
+		inline cl_event enqueue_join(cl_command_queue queue, std::vector<cl_event>& events, bool want_event = true) {
+			cl_event ev_join = nullptr;
+			cl_int errcode = clEnqueueMarkerWithWaitList(queue, static_cast<cl_uint>(events.size()), events.data(), want_event ? &ev_join : NULL);
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing join marker");
+			for(cl_event ev : events) clReleaseEvent(ev);
+			events.clear();
+			return ev_join;
+		}
 
-				assert(false && "cl_rect_upate_lib - 3D kernel transfer not implemented yet");
-				return ev_ret;
+		/// Writes host data to "buffer". With pinned staging enabled, data outside the pinned staging buffers is copied
+		/// to one first, so the DMA reads from page-locked memory and the caller's memory may be reused on return.
+		/// Without "want_event", a direct write creates no event and nullptr is returned.
+		inline cl_event enqueue_host_write(cl_rul_context& lib, cl_command_queue queue, cl_mem buffer, size_t offset, size_t size, const void* host_data, const WaitList& wait, bool want_event = true) {
+			cl_event ev_write = nullptr;
+			if(!lib.get_pinned_staging() || lib.is_pinned(host_data)) {
+				cl_int errcode = clEnqueueWriteBuffer(queue, buffer, CL_FALSE, offset, size, host_data, wait.count, wait.events, want_event ? &ev_write : NULL);
+				CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing host transfer");
+				return ev_write;
 			}
+
+			cl_mem pinned_buffer;
+			void* pinned_ptr = lib.acquire_pinned_staging_buffer(size, pinned_buffer);
+			host::copy_bytes(pinned_ptr, host_data, size);
+			cl_int errcode = clEnqueueWriteBuffer(queue, buffer, CL_FALSE, offset, size, pinned_ptr, wait.count, wait.events, &ev_write);
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing pinned host transfer");
+			lib.release_pinned_staging_buffer(pinned_buffer, ev_write);
+			return return_event(queue, ev_write, want_event);
+		}
+
+		struct pinned_read_completion {
+			host::box_copy unpack;
+			cl_event ev_done;
+			unpack_worker* worker;
 		};
 
+		inline void CL_CALLBACK complete_pinned_read(cl_event, cl_int status, void* user_data) {
+			pinned_read_completion* c = static_cast<pinned_read_completion*>(user_data);
+			c->worker->post(c->unpack, c->ev_done, status);
+			delete c;
+		}
+
+		/// Reads "size" bytes of "buffer" into a pinned staging buffer and performs "unpack" from it (its source is set here)
+		/// on the unpack worker of the library instance, once the read has completed. Returns a user event which completes
+		/// after that copy.
+		inline cl_event enqueue_pinned_read(cl_rul_context& lib, cl_command_queue queue, cl_mem buffer, size_t offset, size_t size, host::box_copy unpack, const WaitList& wait) {
+			cl_mem pinned_buffer;
+			void* pinned_ptr = lib.acquire_pinned_staging_buffer(size, pinned_buffer);
+			cl_event ev_read;
+			cl_int errcode = clEnqueueReadBuffer(queue, buffer, CL_FALSE, offset, size, pinned_ptr, wait.count, wait.events, &ev_read);
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing pinned host transfer");
+
+			cl_event ev_done = clCreateUserEvent(lib.get_cl_context(), &errcode);
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error creating pinned transfer event");
+			clRetainEvent(ev_done); // released by the unpack worker
+			unpack.src = pinned_ptr;
+			errcode = clSetEventCallback(ev_read, CL_COMPLETE, complete_pinned_read, new pinned_read_completion{ unpack, ev_done, &lib.get_unpack_worker() });
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error setting pinned transfer callback");
+			clFlush(queue); // the callback can only fire once the read was submitted
+
+			// the user event always reports CL_SUBMITTED, the read tells whether it may still wait for the caller
+			lib.release_pinned_staging_buffer(pinned_buffer, ev_done, ev_read);
+			clReleaseEvent(ev_read);
+			return ev_done;
+		}
+
+		/// Reads "buffer" into host memory. With pinned staging enabled, targets outside the pinned staging buffers are
+		/// read into one first and copied over by the unpack worker; the returned user event completes after that copy.
+		/// Without "want_event", a direct read creates no event and nullptr is returned.
+		inline cl_event enqueue_host_read(cl_rul_context& lib, cl_command_queue queue, cl_mem buffer, size_t offset, size_t size, void* host_target, const WaitList& wait, bool want_event = true) {
+			if(!lib.get_pinned_staging() || lib.is_pinned(host_target)) {
+				cl_event ev_read = nullptr;
+				cl_int errcode = clEnqueueReadBuffer(queue, buffer, CL_FALSE, offset, size, host_target, wait.count, wait.events, want_event ? &ev_read : NULL);
+				CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing host transfer");
+				return ev_read;
+			}
+			return return_event(queue, enqueue_pinned_read(lib, queue, buffer, offset, size, { host_target, nullptr, size, 1, 1, size, size, size, size }, wait), want_event);
+		}
+
+		/// Writes a box of host data laid out with "host_pitch" packed to the start of "staging_buffer". Packed host data goes
+		/// through enqueue_host_write. Otherwise, with pinned staging the box is packed into pinned memory on the host, and
+		/// without it the runtime gathers the rows during the transfer.
 		template<typename T>
-		struct rect_uploader<T, Automatic> {
-			cl_event operator()(cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *linearized_host_data_source) {
-				// try being smarter later
-				return rect_uploader<T, Kernel>()(queue, target_buffer, target_buffer_size, target_box, linearized_host_data_source);
+		cl_event enqueue_host_pack(cl_rul_context& lib, cl_command_queue queue, cl_mem staging_buffer, const Extent& e, const T* host_data, const Pitch& host_pitch, const WaitList& wait) {
+			if(host_pitch.is_packed(e)) return enqueue_host_write(lib, queue, staging_buffer, 0, e.size() * sizeof(T), host_data, wait);
+			if(lib.get_pinned_staging()) {
+				cl_mem pinned_buffer;
+				T* pinned_ptr = static_cast<T*>(lib.acquire_pinned_staging_buffer(e.size() * sizeof(T), pinned_buffer));
+				host::pack(pinned_ptr, host_data, host_pitch, e);
+				cl_event ev_write;
+				cl_int errcode = clEnqueueWriteBuffer(queue, staging_buffer, CL_FALSE, 0, e.size() * sizeof(T), pinned_ptr, wait.count, wait.events, &ev_write);
+				CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing pinned host transfer");
+				lib.release_pinned_staging_buffer(pinned_buffer, ev_write);
+				return ev_write;
 			}
-		};
+			const size_t origin[3] = { 0, 0, 0 };
+			const size_t region[3] = { e.xs * sizeof(T), e.ys, e.zs };
+			cl_event ev_write;
+			cl_int errcode = clEnqueueWriteBufferRect(queue, staging_buffer, CL_FALSE, origin, origin, region,
+				e.xs * sizeof(T), e.slice_size() * sizeof(T), host_pitch.row * sizeof(T), host_pitch.slice * sizeof(T),
+				host_data, wait.count, wait.events, &ev_write);
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing pitched staging transfer");
+			return ev_write;
+		}
+
+		/// Reads a box packed at the start of "staging_buffer" into host memory laid out with "host_pitch", see enqueue_host_pack.
+		template<typename T>
+		cl_event enqueue_host_unpack(cl_rul_context& lib, cl_command_queue queue, cl_mem staging_buffer, const Extent& e, T* host_target, const Pitch& host_pitch, const WaitList& wait) {
+			if(host_pitch.is_packed(e)) return enqueue_host_read(lib, queue, staging_buffer, 0, e.size() * sizeof(T), host_target, wait);
+			if(lib.get_pinned_staging()) {
+				const host::box_copy unpack = host::make_box_copy<T>(host_target, host_pitch, nullptr, Pitch::packed(e), e);
+				return enqueue_pinned_read(lib, queue, staging_buffer, 0, e.size() * sizeof(T), unpack, wait);
+			}
+			const size_t origin[3] = { 0, 0, 0 };
+			const size_t region[3] = { e.xs * sizeof(T), e.ys, e.zs };
+			cl_event ev_read;
+			cl_int errcode = clEnqueueReadBufferRect(queue, staging_buffer, CL_FALSE, origin, origin, region,
+				e.xs * sizeof(T), e.slice_size() * sizeof(T), host_pitch.row * sizeof(T), host_pitch.slice * sizeof(T),
+				host_target, wait.count, wait.events, &ev_read);
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing pitched staging transfer");
+			return ev_read;
+		}
+
+	} // namespace detail
+
+	/**
+	 * @brief Initializes the cl_rect_update library for a context and device.
+	 *
+	 * Every context and device has its own library instance, with its own kernels, staging buffers and settings, which transfers look
+	 * up from their queue; several devices may be driven from different threads at the same time. An instance is also created with
+	 * the default settings by the first transfer on a queue of a device that was not initialized. The settings functions without a
+	 * queue apply to the instance created first.
+	 *
+	 * @param eager If true, transfer kernels for all predefined types are compiled in the background right away, instead of when they're
+	 *              first required. The call returns immediately; a transfer waits only for the build of the program holding its kernel.
+	 * @param calibrate If true, the cost model used by the Automatic method is measured on the device (takes roughly a second).
+	 * @param cost_profile If given, the cost model is loaded from this file; if that fails and calibrate is set, the measured model is saved to it.
+	 */
+	inline void init_rect_update_lib(cl_context context, cl_device_id device, bool eager = false, bool calibrate = false, const char* cost_profile = nullptr) {
+		detail::cl_rul_context& lib = detail::g_instances.get(context, device);
+
+		if (eager) {
+			// types of the same size share their kernels, so this builds one set per distinct size
+			#define BUF_TYPE(_htype, _dtype) detail::start_transfer_kernel_builds<_htype>(lib);
+			#include "buffer_types.inc"
+			#undef BUF_TYPE
+		}
+
+		cost_model model = cost_model::defaults();
+		if(cost_profile && model.load(cost_profile)) {
+			lib.set_cost_model(model);
+		}
+		else if(calibrate) {
+			lib.set_cost_model(detail::measure_cost_model(lib));
+			if(cost_profile && !lib.get_cost_model().save(cost_profile)) {
+				fprintf(stderr, "cl_rect_update_lib - could not save cost profile to %s\n", cost_profile);
+			}
+		}
 	}
 
-	template<typename T, typename Method = Automatic>
-	cl_event upload_rect(cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *linearized_host_data_source) {
-		return detail::rect_uploader<T, Method>{}(queue, target_buffer, target_buffer_size, target_box, linearized_host_data_source);
+	/// Releases the resources of all library instances, a later initialization or transfer starts over with the default settings.
+	/// Call this before exit: instances still alive at static destruction are not released.
+	inline void reset_rect_update_lib() {
+		detail::g_instances.clear();
 	}
 
+	/// Releases the resources of the library instance for "context" and "device" only.
+	inline void reset_rect_update_lib(cl_context context, cl_device_id device) {
+		detail::g_instances.remove(context, device);
+	}
 
-	/// Download functions ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	/**
+	 * @brief Caches the binaries of the transfer kernels in "directory", which must exist (nullptr disables the cache, the default).
+	 *
+	 * Later runs load the kernels from there instead of compiling them, which makes an eager init_rect_update_lib fast; call this
+	 * before it. Binaries are specific to the device, its driver version, the build options and the kernel source.
+	 */
+	inline void set_kernel_cache_directory(const char* directory) {
+		detail::g_instances.set_kernel_cache_directory(directory ? directory : "");
+	}
+
+	/// Cost model of the default library instance, the one initialized first; see the queue overload for other devices.
+	inline const cost_model& get_cost_model() {
+		return detail::g_instances.get_default().get_cost_model();
+	}
+
+	/// Cost model of the library instance used by "queue".
+	inline const cost_model& get_cost_model(cl_command_queue queue) {
+		return detail::instance_of(queue).get_cost_model();
+	}
+
+	/// Replaces the cost model of the default library instance, the one initialized first.
+	inline void set_cost_model(const cost_model& model) {
+		detail::g_instances.get_default().set_cost_model(model);
+	}
+
+	/// Replaces the cost model of the library instance used by "queue".
+	inline void set_cost_model(cl_command_queue queue, const cost_model& model) {
+		detail::instance_of(queue).set_cost_model(model);
+	}
+
+	/**
+	 * @brief Enables staging of host data through pinned (page-locked) memory owned by the library.
+	 *
+	 * Host data of the Kernel method is then copied to a pinned buffer and DMA'd from there, instead of letting the driver bounce
+	 * a pageable pointer. The source memory of an upload may be reused as soon as the call returns. Downloads complete (their
+	 * returned event fires) only after the data was copied to the caller's memory. Data already in a pinned_region is not copied.
+	 * Applies to the default library instance, the one initialized first; use the queue overload for other devices.
+	 */
+	inline void set_pinned_staging(bool enable) {
+		detail::g_instances.get_default().set_pinned_staging(enable);
+	}
+
+	/// set_pinned_staging for the library instance used by "queue".
+	inline void set_pinned_staging(cl_command_queue queue, bool enable) {
+		detail::instance_of(queue).set_pinned_staging(enable);
+	}
+
+	/// Page-locked host memory for "count" elements, owned by the library.
+	template<typename T>
+	struct pinned_region {
+		T* data;
+		size_t count;
+		cl_mem buffer; ///< backing buffer, mapped for the lifetime of the library
+		detail::cl_rul_context* lib; ///< instance owning the buffer
+	};
+
+	namespace detail {
+		template<typename T>
+		pinned_region<T> acquire_pinned_region(cl_rul_context& lib, size_t count) {
+			pinned_region<T> region;
+			region.data = static_cast<T*>(lib.acquire_pinned_staging_buffer(count * sizeof(T), region.buffer));
+			region.count = count;
+			region.lib = &lib;
+			return region;
+		}
+	}
+
+	/**
+	 * @brief Hands out pinned host memory, which can be filled in place and passed to upload_rect (or used as target of download_rect)
+	 * with any method, avoiding any intermediate host copy. The region must be given back with release_pinned_region.
+	 * The memory belongs to the default library instance, the one initialized first, and is only pinned for transfers on its
+	 * device; use the queue overload for other devices.
+	 */
+	template<typename T>
+	pinned_region<T> acquire_pinned_region(size_t count) {
+		return detail::acquire_pinned_region<T>(detail::g_instances.get_default(), count);
+	}
+
+	/// acquire_pinned_region for the library instance used by "queue", the region is only pinned for transfers on its device.
+	template<typename T>
+	pinned_region<T> acquire_pinned_region(cl_command_queue queue, size_t count) {
+		return detail::acquire_pinned_region<T>(detail::instance_of(queue), count);
+	}
+
+	/// Gives back a region once "ev_done" (usually the event of the last transfer using it) has completed, or immediately if null.
+	template<typename T>
+	void release_pinned_region(const pinned_region<T>& region, cl_event ev_done = nullptr) {
+		region.lib->release_pinned_staging_buffer(region.buffer, ev_done);
+	}
+
+	/**
+	 * @brief Enables pipelined Kernel transfers of boxes of at least "min_bytes" (0 disables them).
+	 *
+	 * Such boxes are split into chunks of whole slices (or rows) of about "chunk_bytes", each staged in its own buffer. If "copy_queue"
+	 * is given, the host transfers run on it and overlap the transfer kernels on the caller's queue, so a large transfer takes
+	 * roughly the longer of its DMA and kernel time rather than their sum. "copy_queue" must belong to the same context and device.
+	 * The setting applies to the library instance of "copy_queue", or without it to the default one, initialized first; use the
+	 * queue overload for other devices.
+	 */
+	inline void set_pipelining(size_t min_bytes, size_t chunk_bytes = 16 << 20, cl_command_queue copy_queue = nullptr) {
+		detail::pipeline_config config;
+		config.min_bytes = min_bytes;
+		config.chunk_bytes = chunk_bytes;
+		config.copy_queue = copy_queue;
+		detail::cl_rul_context& lib = copy_queue ? detail::instance_of(copy_queue) : detail::g_instances.get_default();
+		lib.set_pipelining(config);
+	}
+
+	/// set_pipelining for the library instance used by "queue", "copy_queue" must belong to the same context and device.
+	inline void set_pipelining(cl_command_queue queue, size_t min_bytes, size_t chunk_bytes = 16 << 20, cl_command_queue copy_queue = nullptr) {
+		detail::pipeline_config config;
+		config.min_bytes = min_bytes;
+		config.chunk_bytes = chunk_bytes;
+		config.copy_queue = copy_queue;
+		detail::cl_rul_context& lib = detail::instance_of(queue);
+		assert((!copy_queue || &detail::instance_of(copy_queue) == &lib) && "cl_rect_update_lib - copy queue of another context or device");
+		lib.set_pipelining(config);
+	}
+
+	/// Upload functions ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Update methods (tag type dispatch)
+	class Individual {};
+	class ClRect {};
+	/// Packs the box in a staging buffer and moves it with a transfer kernel. Until the kernels of the element type have been
+	/// compiled (see init_rect_update_lib), the transfer is served by ClRect instead, without pipelining.
+	class Kernel {};
+	/// Maps the range enclosing the box and copies it on the host. The map is blocking: the call returns only after the commands
+	/// already enqueued on the queue (and the wait list) have completed and the data was copied. Only used when requested, it
+	/// avoids any copy by the runtime on devices with host unified memory.
+	class Mapped {};
+	/// Picks an asynchronous method per box from the cost model, never Mapped.
+	class Automatic {};
+	class Runtime {};
+
+	/// Selects the fire-and-forget overloads of upload_rect and download_rect, which return no event and create none unless the
+	/// method needs it internally (staging buffers are tracked by events). Meant for in-order queues, which order later commands anyway.
+	struct NoEvent {};
+	constexpr NoEvent no_event = {};
 
 	namespace detail {
 		template<typename T, typename Method = Automatic>
-		struct rect_downloader {
-			cl_event operator()(cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *linearized_host_data_target);
+		struct rect_uploader {
+			cl_event operator()(cl_rul_context& lib, cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *host_data_source, const Pitch& host_pitch, const WaitList& wait, bool want_event);
 		};
 
 		template<typename T>
-		struct rect_downloader<T, Individual> {
-			cl_event operator()(cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *linearized_host_data_target) {
+		struct rect_uploader<T, Individual> {
+			cl_event operator()(cl_rul_context&, cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *host_data_source, const Pitch& host_pitch, const WaitList& wait, bool want_event) {
 				cl_event ev_ret = nullptr;
+				// rows may complete in any order on an out-of-order queue, so all of them are joined
+				const bool out_of_order = want_event && is_out_of_order(queue);
+				std::vector<cl_event> row_events;
+				cl_event row_event;
 
-				const Point& o = source_box.origin;
-				const Extent& e = source_box.extent;
-				const Extent& full_e = source_buffer_size;
-
-				T* trg_ptr = linearized_host_data_target;
+				const Point& o = target_box.origin;
+				const Extent& e = target_box.extent;
+				const Extent& full_e = target_buffer_size;
 
 				size_t zend = o.z + e.zs;
 				size_t yend = o.y + e.ys;
@@ -446,127 +1752,1266 @@ namespace cl_rul {
 					for(size_t y = o.y; y < yend; y++) {
 						bool last = z == zend - 1 && y == yend - 1;
 						size_t offset = full_e.row_offset(y, z) + o.x;
-						//printf("cl_rect_update_lib - individual download  offset: %8u ; range: %8u\n", (unsigned)(offset * sizeof(T)), (unsigned)(e.xs * sizeof(T)));
-						cl_int errcode = clEnqueueReadBuffer(queue, source_buffer, CL_FALSE, offset * sizeof(T), e.xs * sizeof(T), trg_ptr, 0, NULL, last ? &ev_ret : NULL);
-						CLU_ERRCHECK(errcode, "cl_rect_update_lib - download_rect: error enqueueing individual transfer");
-						trg_ptr += e.xs;
+						const T* source_ptr = host_data_source + (z - o.z) * host_pitch.slice + (y - o.y) * host_pitch.row;
+						//printf("cl_rect_update_lib - individual upload offset: %8u ; range: %8u\n", (unsigned)(offset * sizeof(T)), (unsigned)(e.xs * sizeof(T)));
+						cl_int errcode = clEnqueueWriteBuffer(queue, target_buffer, CL_FALSE, offset * sizeof(T), e.xs * sizeof(T), source_ptr, wait.count, wait.events, out_of_order ? &row_event : (last && want_event ? &ev_ret : NULL));
+						if(out_of_order) row_events.push_back(row_event);
+						CLU_ERRCHECK(errcode, "cl_rect_update_lib - upload_rect: error enqueueing individual transfer");
 					}
 				}
 
+				if(!row_events.empty()) ev_ret = enqueue_join(queue, row_events);
 				return ev_ret;
 			}
 		};
 
 		template<typename T>
-		struct rect_downloader<T, ClRect> {
-			cl_event operator()(cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *linearized_host_data_target) {
-				cl_event ev_ret;
+		struct rect_uploader<T, ClRect> {
+			cl_event operator()(cl_rul_context&, cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *host_data_source, const Pitch& host_pitch, const WaitList& wait, bool want_event) {
+				cl_event ev_ret = nullptr;
 
-				const Point& o = source_box.origin;
-				const Extent& e = source_box.extent;
-				const Extent& full_e = source_buffer_size;
+				const Point& o = target_box.origin;
+				const Extent& e = target_box.extent;
+				const Extent& full_e = target_buffer_size;
 
 				const size_t buffer_origin[3] = { o.x * sizeof(T), o.y, o.z };
 				const size_t host_origin[3] = { 0, 0, 0 };
 				const size_t region[3] = { e.xs * sizeof(T), e.ys, e.zs };
 				size_t buffer_row_pitch = full_e.xs * sizeof(T);
 				size_t buffer_slice_pitch = full_e.slice_size() * sizeof(T);
-				size_t host_row_pitch = e.xs * sizeof(T);
-				size_t host_slice_pitch = e.slice_size() * sizeof(T);
-				cl_int errcode = clEnqueueReadBufferRect(queue, source_buffer, CL_FALSE,
+				size_t host_row_pitch = host_pitch.row * sizeof(T);
+				size_t host_slice_pitch = host_pitch.slice * sizeof(T);
+				cl_int errcode = clEnqueueWriteBufferRect(queue, target_buffer, CL_FALSE,
 					buffer_origin, host_origin, region,
 					buffer_row_pitch, buffer_slice_pitch, host_row_pitch, host_slice_pitch,
-					linearized_host_data_target, 0, NULL, &ev_ret);
-				CLU_ERRCHECK(errcode, "cl_rect_upate_lib - download_rect: error enqueueing clrect transfer");
+					host_data_source, wait.count, wait.events, want_event ? &ev_ret : NULL);
+				CLU_ERRCHECK(errcode, "cl_rect_upate_lib - upload_rect: error enqueueing clrect transfer");
 
 				return ev_ret;
 			}
 		};
 
 		template<typename T>
-		cl_event download_rect_kernel_2D(cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *linearized_host_data_target) {
-
-			const Point& o = source_box.origin;
-			const Extent& e = source_box.extent;
-			const Extent& full_e = source_buffer_size;
-
-			// get staging buffer
+		cl_event enqueue_upload_kernel_2D(cl_rul_context& lib, cl_command_queue queue, cl_mem staging_buffer, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const WaitList& wait) {
+			const Point& o = target_box.origin;
+			const Extent& e = target_box.extent;
+			const Extent& full_e = target_buffer_size;
 
-			size_t required_staging_size = e.size() * sizeof(T);
-			cl_mem staging_buffer = g_context.get_staging_buffer(required_staging_size);
+			if(use_vector_kernel<T>(lib, e)) return enqueue_vector_kernel<T>(lib, queue, kernel_id::UploadVec, staging_buffer, target_buffer, target_buffer_size, target_box, wait);
 
-			// use kernel to write to staging buffer
+			// use kernel to write from staging buffer to final destination
 			// parameters:
 			//		__global v_t *src, __global v_t *trg,
 			//		uint pos_x, uint pos_y,
 			//		uint size_x, uint size_y,
-			//		uint stride
+			//		uint stride(, uint rows_per_group for narrow boxes)
 
-			cl_kernel kernel = get_download_kernel_2D<T>();
+			const bool tiled = is_narrow(e);
+			cl_kernel kernel = get_transfer_kernel<T>(lib, tiled ? kernel_id::UploadTiled2D : kernel_id::Upload2D);
 
 			cl_event ev_kernel;
-			cl_uint pos_x = static_cast<cl_uint>(o.x), pos_y = static_cast<cl_uint>(o.y);
+			// a single slice of a 3D buffer is addressed by folding its z offset into the row index
+			cl_uint pos_x = static_cast<cl_uint>(o.x), pos_y = static_cast<cl_uint>(o.z * full_e.ys + o.y);
 			cl_uint size_x = static_cast<cl_uint>(e.xs), size_y = static_cast<cl_uint>(e.ys);
 			cl_uint stride = static_cast<cl_uint>(full_e.xs);
 			cluSetKernelArguments(kernel, 7,
-				sizeof(cl_mem), &source_buffer, sizeof(cl_mem), &staging_buffer,
+				sizeof(cl_mem), &staging_buffer, sizeof(cl_mem), &target_buffer,
 				sizeof(cl_uint), &pos_x, sizeof(cl_uint), &pos_y,
 				sizeof(cl_uint), &size_x, sizeof(cl_uint), &size_y,
 				sizeof(cl_uint), &stride);
-			size_t global_size = e.size();
-			cl_int errcode = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, 0, 0, NULL, &ev_kernel);
-			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing download kernel");
-
-			// transfer from staging buffer to host
-
-			cl_event ev_staging;
-			errcode = clEnqueueReadBuffer(queue, staging_buffer, CL_FALSE, 0, required_staging_size, linearized_host_data_target, 0, NULL, &ev_staging);
-			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing staging transfer");
+			cl_int errcode = enqueue_transfer_kernel_2D(queue, kernel, tiled, e, wait, &ev_kernel);
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing upload kernel");
 
-			return ev_staging;
+			return ev_kernel;
 		}
 
 		template<typename T>
-		struct rect_downloader<T, Kernel> {
-			cl_event operator()(cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *linearized_host_data_target) {
-				cl_event ev_ret = nullptr;
+		cl_event enqueue_upload_kernel_3D(cl_rul_context& lib, cl_command_queue queue, cl_mem staging_buffer, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const WaitList& wait) {
+			const Point& o = target_box.origin;
+			const Extent& e = target_box.extent;
+			const Extent& full_e = target_buffer_size;
 
-				const Extent& s = source_buffer_size;
-				const Point& o = source_box.origin;
-				const Extent& e = source_box.extent;
+			if(use_vector_kernel<T>(lib, e)) return enqueue_vector_kernel<T>(lib, queue, kernel_id::UploadVec, staging_buffer, target_buffer, target_buffer_size, target_box, wait);
 
-				// if 1D, just use simple transfer
-				if(e.ys == 1 && e.zs == 1) {
-					const size_t linear_offset = o.z * s.xs * s.ys + o.y * s.xs + o.x;
-					cl_int errcode = clEnqueueReadBuffer(queue, source_buffer, CL_FALSE, linear_offset * sizeof(T), e.xs * sizeof(T), linearized_host_data_target, 0, NULL, &ev_ret);
-					CLU_ERRCHECK(errcode, "cl_rect_update_lib - download_rect: error enqueueing transfer");
-					return ev_ret;
-				}
+			// use kernel to write from staging buffer to final destination
+			// parameters:
+			//		__global v_t *src, __global v_t *trg,
+			//		uint pos_x, uint pos_y, uint pos_z,
+			//		uint size_x, uint size_y, uint size_z,
+			//		uint stride, uint slice_stride
 
-				// if 2D or 3D use linearized transfer and specialized kernel
-				if(e.zs == 1) return download_rect_kernel_2D<T>(queue, source_buffer, source_buffer_size, source_box, linearized_host_data_target);
+			cl_kernel kernel = get_transfer_kernel<T>(lib, kernel_id::Upload3D);
 
-				assert(false && "cl_rect_upate_lib - 3D kernel transfer not implemented yet");
-				return ev_ret;
-			}
-		};
+			cl_event ev_kernel;
+			cl_uint pos_x = static_cast<cl_uint>(o.x), pos_y = static_cast<cl_uint>(o.y), pos_z = static_cast<cl_uint>(o.z);
+			cl_uint size_x = static_cast<cl_uint>(e.xs), size_y = static_cast<cl_uint>(e.ys), size_z = static_cast<cl_uint>(e.zs);
+			cl_uint stride = static_cast<cl_uint>(full_e.xs), slice_stride = static_cast<cl_uint>(full_e.slice_size());
+			cluSetKernelArguments(kernel, 10,
+				sizeof(cl_mem), &staging_buffer, sizeof(cl_mem), &target_buffer,
+				sizeof(cl_uint), &pos_x, sizeof(cl_uint), &pos_y, sizeof(cl_uint), &pos_z,
+				sizeof(cl_uint), &size_x, sizeof(cl_uint), &size_y, sizeof(cl_uint), &size_z,
+				sizeof(cl_uint), &stride, sizeof(cl_uint), &slice_stride);
+			const transfer_ndrange range = make_transfer_ndrange(e);
+			cl_int errcode = clEnqueueNDRangeKernel(queue, kernel, 3, NULL, range.global, range.local, wait.count, wait.events, &ev_kernel);
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing 3D upload kernel");
+
+			return ev_kernel;
+		}
 
 		template<typename T>
-		struct rect_downloader<T, Automatic> {
-			cl_event operator()(cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *linearized_host_data_target) {
-				// try being smarter later
-				return rect_downloader<T, Kernel>()(queue, source_buffer, source_buffer_size, source_box, linearized_host_data_target);
-			}
-		};
-	}
+		cl_event upload_rect_kernel_2D(cl_rul_context& lib, cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *host_data_source, const Pitch& host_pitch, const WaitList& wait) {
 
-	template<typename T, typename Method = Automatic>
-	cl_event download_rect(cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *linearized_host_data_target) {
-#ifndef NDEBUG
-		detail::check_global_state_validity(queue);
-#endif
-		return detail::rect_downloader<T, Method>{}(queue, source_buffer, source_buffer_size, source_box, linearized_host_data_target);
-	}
+			// transfer linearly to staging buffer
 
-} // namespace cl_rul
+			size_t required_staging_size = target_box.size() * sizeof(T);
+			cl_mem staging_buffer = lib.acquire_staging_buffer(required_staging_size);
+			cl_event ev_staging = enqueue_host_pack(lib, queue, staging_buffer, target_box.extent, host_data_source, host_pitch, wait);
 
+			// use kernel to write to final destination
+
+			cl_event ev_kernel = enqueue_upload_kernel_2D<T>(lib, queue, staging_buffer, target_buffer, target_buffer_size, target_box, ev_staging);
+			clReleaseEvent(ev_staging);
+			lib.release_staging_buffer(staging_buffer, ev_kernel);
+			return ev_kernel;
+		}
+
+		template<typename T>
+		cl_event upload_rect_kernel_3D(cl_rul_context& lib, cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *host_data_source, const Pitch& host_pitch, const WaitList& wait) {
+
+			// transfer linearly to staging buffer
+
+			size_t required_staging_size = target_box.size() * sizeof(T);
+			cl_mem staging_buffer = lib.acquire_staging_buffer(required_staging_size);
+			cl_event ev_staging = enqueue_host_pack(lib, queue, staging_buffer, target_box.extent, host_data_source, host_pitch, wait);
+
+			// use kernel to write to final destination
+
+			cl_event ev_kernel = enqueue_upload_kernel_3D<T>(lib, queue, staging_buffer, target_buffer, target_buffer_size, target_box, ev_staging);
+			clReleaseEvent(ev_staging);
+			lib.release_staging_buffer(staging_buffer, ev_kernel);
+			return ev_kernel;
+		}
+
+		/// True if "box" is large enough for a pipelined Kernel transfer and splits into more than one chunk.
+		inline bool use_pipelining(cl_rul_context& lib, const Box& box, size_t element_size) {
+			const pipeline_config& config = lib.get_pipelining();
+			const size_t bytes = box.size() * element_size;
+			return config.min_bytes > 0 && bytes >= config.min_bytes && bytes > config.chunk_bytes;
+		}
+
+		/**
+		 * @brief Kernel upload in chunks, each staged in its own buffer from the pool.
+		 *
+		 * With a separate copy queue, the host transfer of a chunk runs there and overlaps the kernel of the previous chunk.
+		 * On a single in-order queue the chunks still run back to back. The returned marker completes with the last kernel.
+		 */
+		template<typename T>
+		cl_event upload_rect_kernel_pipelined(cl_rul_context& lib, cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *host_data_source, const Pitch& host_pitch, const WaitList& wait, bool want_event) {
+			const pipeline_config& config = lib.get_pipelining();
+			cl_command_queue copy_queue = config.copy_queue ? config.copy_queue : queue;
+			const Point& o = target_box.origin;
+
+			std::vector<cl_event> chunk_events;
+			for(const Box& chunk : split_box(target_box, sizeof(T), config.chunk_bytes)) {
+				const T* chunk_source = host_data_source + (chunk.origin.z - o.z) * host_pitch.slice + (chunk.origin.y - o.y) * host_pitch.row;
+				cl_mem staging_buffer = lib.acquire_staging_buffer(chunk.size() * sizeof(T));
+				cl_event ev_staging = enqueue_host_pack(lib, copy_queue, staging_buffer, chunk.extent, chunk_source, host_pitch, wait);
+				if(copy_queue != queue) clFlush(copy_queue); // the kernel must not wait on a transfer that was never submitted
+
+				cl_event ev_kernel;
+				if(chunk.extent.zs == 1) ev_kernel = enqueue_upload_kernel_2D<T>(lib, queue, staging_buffer, target_buffer, target_buffer_size, chunk, ev_staging);
+				else ev_kernel = enqueue_upload_kernel_3D<T>(lib, queue, staging_buffer, target_buffer, target_buffer_size, chunk, ev_staging);
+				clReleaseEvent(ev_staging);
+				lib.release_staging_buffer(staging_buffer, ev_kernel);
+				chunk_events.push_back(ev_kernel);
+			}
+			return enqueue_join(queue, chunk_events, want_event);
+		}
+
+		template<typename T>
+		struct rect_uploader<T, Kernel> {
+			cl_event operator()(cl_rul_context& lib, cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *host_data_source, const Pitch& host_pitch, const WaitList& wait, bool want_event) {
+				const Extent& s = target_buffer_size;
+				const Point& o = target_box.origin;
+				const Extent& e = target_box.extent;
+
+				// if the box is contiguous in the buffer (1D or full rows), just use simple transfer
+				if(is_linear(s, target_box)) {
+					if(!host_pitch.is_packed(e)) return rect_uploader<T, ClRect>()(lib, queue, target_buffer, target_buffer_size, target_box, host_data_source, host_pitch, wait, want_event);
+					const size_t linear_offset = o.z * s.xs * s.ys + o.y * s.xs + o.x;
+					return enqueue_host_write(lib, queue, target_buffer, linear_offset * sizeof(T), e.size() * sizeof(T), host_data_source, wait, want_event);
+				}
+
+				// if 2D or 3D use linearized transfer and specialized kernel, as soon as it has been compiled
+				if(!transfer_kernels_ready<T>(lib, target_box)) return rect_uploader<T, ClRect>()(lib, queue, target_buffer, target_buffer_size, target_box, host_data_source, host_pitch, wait, want_event);
+				if(use_pipelining(lib, target_box, sizeof(T))) return upload_rect_kernel_pipelined<T>(lib, queue, target_buffer, target_buffer_size, target_box, host_data_source, host_pitch, wait, want_event);
+				// the staging buffer is tracked by the event of the last command, so it is always created
+				if(e.zs == 1) return return_event(queue, upload_rect_kernel_2D<T>(lib, queue, target_buffer, target_buffer_size, target_box, host_data_source, host_pitch, wait), want_event);
+				return return_event(queue, upload_rect_kernel_3D<T>(lib, queue, target_buffer, target_buffer_size, target_box, host_data_source, host_pitch, wait), want_event);
+			}
+		};
+
+		/// Maps the range enclosing the box, copies the rows on the host and unmaps. The map blocks until previous commands
+		/// on "queue" and the wait list have completed; this is a zero-copy path on devices with host unified memory.
+		template<typename T>
+		struct rect_uploader<T, Mapped> {
+			cl_event operator()(cl_rul_context&, cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *host_data_source, const Pitch& host_pitch, const WaitList& wait, bool want_event) {
+				size_t offset, count;
+				enclosing_range(target_buffer_size, target_box, offset, count);
+				// the gaps between rows must survive the map unless the box is contiguous
+				const cl_map_flags flags = is_linear(target_buffer_size, target_box) ? CL_MAP_WRITE_INVALIDATE_REGION : CL_MAP_WRITE;
+
+				cl_int errcode = CL_SUCCESS;
+				T* mapped = static_cast<T*>(clEnqueueMapBuffer(queue, target_buffer, CL_TRUE, flags, offset * sizeof(T), count * sizeof(T), wait.count, wait.events, NULL, &errcode));
+				CLU_ERRCHECK(errcode, "cl_rect_update_lib - upload_rect: error mapping target buffer");
+				host::copy_box(mapped, Pitch::of(target_buffer_size), host_data_source, host_pitch, target_box.extent);
+
+				cl_event ev_ret = nullptr;
+				errcode = clEnqueueUnmapMemObject(queue, target_buffer, mapped, 0, NULL, want_event ? &ev_ret : NULL);
+				CLU_ERRCHECK(errcode, "cl_rect_update_lib - upload_rect: error unmapping target buffer");
+				return ev_ret;
+			}
+		};
+
+		template<typename T>
+		struct rect_uploader<T, Automatic> {
+			cl_event operator()(cl_rul_context& lib, cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *host_data_source, const Pitch& host_pitch, const WaitList& wait, bool want_event) {
+				// contiguous boxes are always a single linear copy, which the Kernel method handles
+				if(is_linear(target_buffer_size, target_box)) {
+					return rect_uploader<T, Kernel>()(lib, queue, target_buffer, target_buffer_size, target_box, host_data_source, host_pitch, wait, want_event);
+				}
+				switch(select_method(lib.get_cost_model().upload, target_box, sizeof(T))) {
+				case method_id::Individual: return rect_uploader<T, Individual>()(lib, queue, target_buffer, target_buffer_size, target_box, host_data_source, host_pitch, wait, want_event);
+				case method_id::ClRect: return rect_uploader<T, ClRect>()(lib, queue, target_buffer, target_buffer_size, target_box, host_data_source, host_pitch, wait, want_event);
+				default: return rect_uploader<T, Kernel>()(lib, queue, target_buffer, target_buffer_size, target_box, host_data_source, host_pitch, wait, want_event);
+				}
+			}
+		};
+	}
+
+	namespace detail {
+		template<typename T>
+		struct rect_uploader<T, Runtime> {
+			cl_event operator()(cl_rul_context& lib, cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *host_data_source, const Pitch& host_pitch, const WaitList& wait, bool want_event) {
+				if(is_linear(target_buffer_size, target_box)) {
+					return rect_uploader<T, Kernel>()(lib, queue, target_buffer, target_buffer_size, target_box, host_data_source, host_pitch, wait, want_event);
+				}
+				// no samples while the kernels compile, the Kernel method would be timed as ClRect
+				if(!transfer_kernels_ready<T>(lib, target_box)) {
+					return rect_uploader<T, ClRect>()(lib, queue, target_buffer, target_buffer_size, target_box, host_data_source, host_pitch, wait, want_event);
+				}
+				return tuned_transfer(queue, lib.get_upload_tuner(), lib.get_cost_model().upload, target_box, sizeof(T), wait, want_event, [&](method_id m, bool want) {
+					switch(m) {
+					case method_id::Individual: return rect_uploader<T, Individual>()(lib, queue, target_buffer, target_buffer_size, target_box, host_data_source, host_pitch, wait, want);
+					case method_id::ClRect: return rect_uploader<T, ClRect>()(lib, queue, target_buffer, target_buffer_size, target_box, host_data_source, host_pitch, wait, want);
+					default: return rect_uploader<T, Kernel>()(lib, queue, target_buffer, target_buffer_size, target_box, host_data_source, host_pitch, wait, want);
+					}
+				});
+			}
+		};
+	}
+
+	template<typename T, typename Method = Automatic>
+	cl_event upload_rect(cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *linearized_host_data_source, const WaitList& wait = WaitList()) {
+		return detail::rect_uploader<T, Method>{}(detail::instance_of(queue), queue, target_buffer, target_buffer_size, target_box, linearized_host_data_source, Pitch::packed(target_box.extent), wait, true);
+	}
+
+	/**
+	 * @brief Uploads a box from host memory with the given row and slice pitch, without packing it first.
+	 *
+	 * "host_data_source" points to the first element of the box. The pitches must be at least as large as a row and a slice of the box.
+	 */
+	template<typename T, typename Method = Automatic>
+	cl_event upload_rect(cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *host_data_source, const Pitch& host_pitch, const WaitList& wait = WaitList()) {
+		return detail::rect_uploader<T, Method>{}(detail::instance_of(queue), queue, target_buffer, target_buffer_size, target_box, host_data_source, host_pitch, wait, true);
+	}
+
+	/// Uploads a box from a host grid of extent "host_size", in which the box starts at "host_origin".
+	template<typename T, typename Method = Automatic>
+	cl_event upload_rect(cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *host_grid, const Extent& host_size, const Point& host_origin, const WaitList& wait = WaitList()) {
+		const T* host_data_source = host_grid + host_size.row_offset(host_origin.y, host_origin.z) + host_origin.x;
+		return upload_rect<T, Method>(queue, target_buffer, target_buffer_size, target_box, host_data_source, Pitch::of(host_size), wait);
+	}
+
+	/// Fire-and-forget upload_rect, see NoEvent.
+	template<typename T, typename Method = Automatic>
+	void upload_rect(NoEvent, cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *linearized_host_data_source, const WaitList& wait = WaitList()) {
+		detail::rect_uploader<T, Method>{}(detail::instance_of(queue), queue, target_buffer, target_buffer_size, target_box, linearized_host_data_source, Pitch::packed(target_box.extent), wait, false);
+	}
+
+	template<typename T, typename Method = Automatic>
+	void upload_rect(NoEvent, cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *host_data_source, const Pitch& host_pitch, const WaitList& wait = WaitList()) {
+		detail::rect_uploader<T, Method>{}(detail::instance_of(queue), queue, target_buffer, target_buffer_size, target_box, host_data_source, host_pitch, wait, false);
+	}
+
+	template<typename T, typename Method = Automatic>
+	void upload_rect(NoEvent, cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box& target_box, const T *host_grid, const Extent& host_size, const Point& host_origin, const WaitList& wait = WaitList()) {
+		const T* host_data_source = host_grid + host_size.row_offset(host_origin.y, host_origin.z) + host_origin.x;
+		detail::rect_uploader<T, Method>{}(detail::instance_of(queue), queue, target_buffer, target_buffer_size, target_box, host_data_source, Pitch::of(host_size), wait, false);
+	}
+
+
+	/// Download functions ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	namespace detail {
+		template<typename T, typename Method = Automatic>
+		struct rect_downloader {
+			cl_event operator()(cl_rul_context& lib, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *host_data_target, const Pitch& host_pitch, const WaitList& wait, bool want_event);
+		};
+
+		template<typename T>
+		struct rect_downloader<T, Individual> {
+			cl_event operator()(cl_rul_context&, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *host_data_target, const Pitch& host_pitch, const WaitList& wait, bool want_event) {
+				cl_event ev_ret = nullptr;
+				// see rect_uploader<T, Individual>
+				const bool out_of_order = want_event && is_out_of_order(queue);
+				std::vector<cl_event> row_events;
+				cl_event row_event;
+
+				const Point& o = source_box.origin;
+				const Extent& e = source_box.extent;
+				const Extent& full_e = source_buffer_size;
+
+				size_t zend = o.z + e.zs;
+				size_t yend = o.y + e.ys;
+				for(size_t z = o.z; z < zend; z++) {
+					for(size_t y = o.y; y < yend; y++) {
+						bool last = z == zend - 1 && y == yend - 1;
+						size_t offset = full_e.row_offset(y, z) + o.x;
+						T* trg_ptr = host_data_target + (z - o.z) * host_pitch.slice + (y - o.y) * host_pitch.row;
+						//printf("cl_rect_update_lib - individual download  offset: %8u ; range: %8u\n", (unsigned)(offset * sizeof(T)), (unsigned)(e.xs * sizeof(T)));
+						cl_int errcode = clEnqueueReadBuffer(queue, source_buffer, CL_FALSE, offset * sizeof(T), e.xs * sizeof(T), trg_ptr, wait.count, wait.events, out_of_order ? &row_event : (last && want_event ? &ev_ret : NULL));
+						if(out_of_order) row_events.push_back(row_event);
+						CLU_ERRCHECK(errcode, "cl_rect_update_lib - download_rect: error enqueueing individual transfer");
+					}
+				}
+
+				if(!row_events.empty()) ev_ret = enqueue_join(queue, row_events);
+				return ev_ret;
+			}
+		};
+
+		template<typename T>
+		struct rect_downloader<T, ClRect> {
+			cl_event operator()(cl_rul_context&, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *host_data_target, const Pitch& host_pitch, const WaitList& wait, bool want_event) {
+				cl_event ev_ret = nullptr;
+
+				const Point& o = source_box.origin;
+				const Extent& e = source_box.extent;
+				const Extent& full_e = source_buffer_size;
+
+				const size_t buffer_origin[3] = { o.x * sizeof(T), o.y, o.z };
+				const size_t host_origin[3] = { 0, 0, 0 };
+				const size_t region[3] = { e.xs * sizeof(T), e.ys, e.zs };
+				size_t buffer_row_pitch = full_e.xs * sizeof(T);
+				size_t buffer_slice_pitch = full_e.slice_size() * sizeof(T);
+				size_t host_row_pitch = host_pitch.row * sizeof(T);
+				size_t host_slice_pitch = host_pitch.slice * sizeof(T);
+				cl_int errcode = clEnqueueReadBufferRect(queue, source_buffer, CL_FALSE,
+					buffer_origin, host_origin, region,
+					buffer_row_pitch, buffer_slice_pitch, host_row_pitch, host_slice_pitch,
+					host_data_target, wait.count, wait.events, want_event ? &ev_ret : NULL);
+				CLU_ERRCHECK(errcode, "cl_rect_upate_lib - download_rect: error enqueueing clrect transfer");
+
+				return ev_ret;
+			}
+		};
+
+		template<typename T>
+		cl_event enqueue_download_kernel_2D(cl_rul_context& lib, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, cl_mem staging_buffer, const WaitList& wait) {
+			const Point& o = source_box.origin;
+			const Extent& e = source_box.extent;
+			const Extent& full_e = source_buffer_size;
+
+			if(use_vector_kernel<T>(lib, e)) return enqueue_vector_kernel<T>(lib, queue, kernel_id::DownloadVec, source_buffer, staging_buffer, source_buffer_size, source_box, wait);
+
+			// use kernel to write to staging buffer
+			// parameters:
+			//		__global v_t *src, __global v_t *trg,
+			//		uint pos_x, uint pos_y,
+			//		uint size_x, uint size_y,
+			//		uint stride(, uint rows_per_group for narrow boxes)
+
+			const bool tiled = is_narrow(e);
+			cl_kernel kernel = get_transfer_kernel<T>(lib, tiled ? kernel_id::DownloadTiled2D : kernel_id::Download2D);
+
+			cl_event ev_kernel;
+			// a single slice of a 3D buffer is addressed by folding its z offset into the row index
+			cl_uint pos_x = static_cast<cl_uint>(o.x), pos_y = static_cast<cl_uint>(o.z * full_e.ys + o.y);
+			cl_uint size_x = static_cast<cl_uint>(e.xs), size_y = static_cast<cl_uint>(e.ys);
+			cl_uint stride = static_cast<cl_uint>(full_e.xs);
+			cluSetKernelArguments(kernel, 7,
+				sizeof(cl_mem), &source_buffer, sizeof(cl_mem), &staging_buffer,
+				sizeof(cl_uint), &pos_x, sizeof(cl_uint), &pos_y,
+				sizeof(cl_uint), &size_x, sizeof(cl_uint), &size_y,
+				sizeof(cl_uint), &stride);
+			cl_int errcode = enqueue_transfer_kernel_2D(queue, kernel, tiled, e, wait, &ev_kernel);
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing download kernel");
+
+			return ev_kernel;
+		}
+
+		template<typename T>
+		cl_event enqueue_download_kernel_3D(cl_rul_context& lib, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, cl_mem staging_buffer, const WaitList& wait) {
+			const Point& o = source_box.origin;
+			const Extent& e = source_box.extent;
+			const Extent& full_e = source_buffer_size;
+
+			if(use_vector_kernel<T>(lib, e)) return enqueue_vector_kernel<T>(lib, queue, kernel_id::DownloadVec, source_buffer, staging_buffer, source_buffer_size, source_box, wait);
+
+			// use kernel to write to staging buffer
+			// parameters:
+			//		__global v_t *src, __global v_t *trg,
+			//		uint pos_x, uint pos_y, uint pos_z,
+			//		uint size_x, uint size_y, uint size_z,
+			//		uint stride, uint slice_stride
+
+			cl_kernel kernel = get_transfer_kernel<T>(lib, kernel_id::Download3D);
+
+			cl_event ev_kernel;
+			cl_uint pos_x = static_cast<cl_uint>(o.x), pos_y = static_cast<cl_uint>(o.y), pos_z = static_cast<cl_uint>(o.z);
+			cl_uint size_x = static_cast<cl_uint>(e.xs), size_y = static_cast<cl_uint>(e.ys), size_z = static_cast<cl_uint>(e.zs);
+			cl_uint stride = static_cast<cl_uint>(full_e.xs), slice_stride = static_cast<cl_uint>(full_e.slice_size());
+			cluSetKernelArguments(kernel, 10,
+				sizeof(cl_mem), &source_buffer, sizeof(cl_mem), &staging_buffer,
+				sizeof(cl_uint), &pos_x, sizeof(cl_uint), &pos_y, sizeof(cl_uint), &pos_z,
+				sizeof(cl_uint), &size_x, sizeof(cl_uint), &size_y, sizeof(cl_uint), &size_z,
+				sizeof(cl_uint), &stride, sizeof(cl_uint), &slice_stride);
+			const transfer_ndrange range = make_transfer_ndrange(e);
+			cl_int errcode = clEnqueueNDRangeKernel(queue, kernel, 3, NULL, range.global, range.local, wait.count, wait.events, &ev_kernel);
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing 3D download kernel");
+
+			return ev_kernel;
+		}
+
+		template<typename T>
+		cl_event download_rect_kernel_2D(cl_rul_context& lib, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *host_data_target, const Pitch& host_pitch, const WaitList& wait) {
+
+			// get staging buffer
+
+			size_t required_staging_size = source_box.size() * sizeof(T);
+			cl_mem staging_buffer = lib.acquire_staging_buffer(required_staging_size);
+
+			// use kernel to write to staging buffer
+
+			cl_event ev_kernel = enqueue_download_kernel_2D<T>(lib, queue, source_buffer, source_buffer_size, source_box, staging_buffer, wait);
+
+			// transfer from staging buffer to host
+
+			cl_event ev_staging = enqueue_host_unpack(lib, queue, staging_buffer, source_box.extent, host_data_target, host_pitch, ev_kernel);
+			clReleaseEvent(ev_kernel);
+			lib.release_staging_buffer(staging_buffer, ev_staging);
+
+			return ev_staging;
+		}
+
+		template<typename T>
+		cl_event download_rect_kernel_3D(cl_rul_context& lib, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *host_data_target, const Pitch& host_pitch, const WaitList& wait) {
+
+			// get staging buffer
+
+			size_t required_staging_size = source_box.size() * sizeof(T);
+			cl_mem staging_buffer = lib.acquire_staging_buffer(required_staging_size);
+
+			// use kernel to write to staging buffer
+
+			cl_event ev_kernel = enqueue_download_kernel_3D<T>(lib, queue, source_buffer, source_buffer_size, source_box, staging_buffer, wait);
+
+			// transfer from staging buffer to host
+
+			cl_event ev_staging = enqueue_host_unpack(lib, queue, staging_buffer, source_box.extent, host_data_target, host_pitch, ev_kernel);
+			clReleaseEvent(ev_kernel);
+			lib.release_staging_buffer(staging_buffer, ev_staging);
+
+			return ev_staging;
+		}
+
+		/// Kernel download in chunks, the mirror image of upload_rect_kernel_pipelined: the host transfer of a chunk on the copy
+		/// queue overlaps the kernel of the next one. The returned marker, on "queue", completes once every chunk has reached the host.
+		template<typename T>
+		cl_event download_rect_kernel_pipelined(cl_rul_context& lib, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *host_data_target, const Pitch& host_pitch, const WaitList& wait, bool want_event) {
+			const pipeline_config& config = lib.get_pipelining();
+			cl_command_queue copy_queue = config.copy_queue ? config.copy_queue : queue;
+			const Point& o = source_box.origin;
+
+			std::vector<cl_event> chunk_events;
+			for(const Box& chunk : split_box(source_box, sizeof(T), config.chunk_bytes)) {
+				cl_mem staging_buffer = lib.acquire_staging_buffer(chunk.size() * sizeof(T));
+				cl_event ev_kernel;
+				if(chunk.extent.zs == 1) ev_kernel = enqueue_download_kernel_2D<T>(lib, queue, source_buffer, source_buffer_size, chunk, staging_buffer, wait);
+				else ev_kernel = enqueue_download_kernel_3D<T>(lib, queue, source_buffer, source_buffer_size, chunk, staging_buffer, wait);
+				if(copy_queue != queue) clFlush(queue);
+
+				T* chunk_target = host_data_target + (chunk.origin.z - o.z) * host_pitch.slice + (chunk.origin.y - o.y) * host_pitch.row;
+				cl_event ev_staging = enqueue_host_unpack(lib, copy_queue, staging_buffer, chunk.extent, chunk_target, host_pitch, ev_kernel);
+				clReleaseEvent(ev_kernel);
+				lib.release_staging_buffer(staging_buffer, ev_staging);
+				chunk_events.push_back(ev_staging);
+			}
+
+			// the join keeps the transfer ordered on the caller's queue; with pinned staging, chunks are completed by the unpack
+			// worker, not necessarily in order
+			if(copy_queue != queue) clFlush(copy_queue);
+			return enqueue_join(queue, chunk_events, want_event);
+		}
+
+		template<typename T>
+		struct rect_downloader<T, Kernel> {
+			cl_event operator()(cl_rul_context& lib, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *host_data_target, const Pitch& host_pitch, const WaitList& wait, bool want_event) {
+				const Extent& s = source_buffer_size;
+				const Point& o = source_box.origin;
+				const Extent& e = source_box.extent;
+
+				// if the box is contiguous in the buffer (1D or full rows), just use simple transfer
+				if(is_linear(s, source_box)) {
+					if(!host_pitch.is_packed(e)) return rect_downloader<T, ClRect>()(lib, queue, source_buffer, source_buffer_size, source_box, host_data_target, host_pitch, wait, want_event);
+					const size_t linear_offset = o.z * s.xs * s.ys + o.y * s.xs + o.x;
+					return enqueue_host_read(lib, queue, source_buffer, linear_offset * sizeof(T), e.size() * sizeof(T), host_data_target, wait, want_event);
+				}
+
+				// if 2D or 3D use linearized transfer and specialized kernel, as soon as it has been compiled
+				if(!transfer_kernels_ready<T>(lib, source_box)) return rect_downloader<T, ClRect>()(lib, queue, source_buffer, source_buffer_size, source_box, host_data_target, host_pitch, wait, want_event);
+				if(use_pipelining(lib, source_box, sizeof(T))) return download_rect_kernel_pipelined<T>(lib, queue, source_buffer, source_buffer_size, source_box, host_data_target, host_pitch, wait, want_event);
+				// the staging buffer is tracked by the event of the last command, so it is always created
+				if(e.zs == 1) return return_event(queue, download_rect_kernel_2D<T>(lib, queue, source_buffer, source_buffer_size, source_box, host_data_target, host_pitch, wait), want_event);
+				return return_event(queue, download_rect_kernel_3D<T>(lib, queue, source_buffer, source_buffer_size, source_box, host_data_target, host_pitch, wait), want_event);
+			}
+		};
+
+		/// Maps the range enclosing the box and copies the rows out on the host, see rect_uploader<T, Mapped>.
+		template<typename T>
+		struct rect_downloader<T, Mapped> {
+			cl_event operator()(cl_rul_context&, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *host_data_target, const Pitch& host_pitch, const WaitList& wait, bool want_event) {
+				size_t offset, count;
+				enclosing_range(source_buffer_size, source_box, offset, count);
+
+				cl_int errcode = CL_SUCCESS;
+				const T* mapped = static_cast<const T*>(clEnqueueMapBuffer(queue, source_buffer, CL_TRUE, CL_MAP_READ, offset * sizeof(T), count * sizeof(T), wait.count, wait.events, NULL, &errcode));
+				CLU_ERRCHECK(errcode, "cl_rect_update_lib - download_rect: error mapping source buffer");
+				host::copy_box(host_data_target, host_pitch, mapped, Pitch::of(source_buffer_size), source_box.extent);
+
+				cl_event ev_ret = nullptr;
+				errcode = clEnqueueUnmapMemObject(queue, source_buffer, const_cast<T*>(mapped), 0, NULL, want_event ? &ev_ret : NULL);
+				CLU_ERRCHECK(errcode, "cl_rect_update_lib - download_rect: error unmapping source buffer");
+				return ev_ret;
+			}
+		};
+
+		template<typename T>
+		struct rect_downloader<T, Automatic> {
+			cl_event operator()(cl_rul_context& lib, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *host_data_target, const Pitch& host_pitch, const WaitList& wait, bool want_event) {
+				// contiguous boxes are always a single linear copy, which the Kernel method handles
+				if(is_linear(source_buffer_size, source_box)) {
+					return rect_downloader<T, Kernel>()(lib, queue, source_buffer, source_buffer_size, source_box, host_data_target, host_pitch, wait, want_event);
+				}
+				switch(select_method(lib.get_cost_model().download, source_box, sizeof(T))) {
+				case method_id::Individual: return rect_downloader<T, Individual>()(lib, queue, source_buffer, source_buffer_size, source_box, host_data_target, host_pitch, wait, want_event);
+				case method_id::ClRect: return rect_downloader<T, ClRect>()(lib, queue, source_buffer, source_buffer_size, source_box, host_data_target, host_pitch, wait, want_event);
+				default: return rect_downloader<T, Kernel>()(lib, queue, source_buffer, source_buffer_size, source_box, host_data_target, host_pitch, wait, want_event);
+				}
+			}
+		};
+	}
+
+	namespace detail {
+		template<typename T>
+		struct rect_downloader<T, Runtime> {
+			cl_event operator()(cl_rul_context& lib, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *host_data_target, const Pitch& host_pitch, const WaitList& wait, bool want_event) {
+				if(is_linear(source_buffer_size, source_box)) {
+					return rect_downloader<T, Kernel>()(lib, queue, source_buffer, source_buffer_size, source_box, host_data_target, host_pitch, wait, want_event);
+				}
+				// no samples while the kernels compile, the Kernel method would be timed as ClRect
+				if(!transfer_kernels_ready<T>(lib, source_box)) {
+					return rect_downloader<T, ClRect>()(lib, queue, source_buffer, source_buffer_size, source_box, host_data_target, host_pitch, wait, want_event);
+				}
+				return tuned_transfer(queue, lib.get_download_tuner(), lib.get_cost_model().download, source_box, sizeof(T), wait, want_event, [&](method_id m, bool want) {
+					switch(m) {
+					case method_id::Individual: return rect_downloader<T, Individual>()(lib, queue, source_buffer, source_buffer_size, source_box, host_data_target, host_pitch, wait, want);
+					case method_id::ClRect: return rect_downloader<T, ClRect>()(lib, queue, source_buffer, source_buffer_size, source_box, host_data_target, host_pitch, wait, want);
+					default: return rect_downloader<T, Kernel>()(lib, queue, source_buffer, source_buffer_size, source_box, host_data_target, host_pitch, wait, want);
+					}
+				});
+			}
+		};
+	}
+
+	template<typename T, typename Method = Automatic>
+	cl_event download_rect(cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *linearized_host_data_target, const WaitList& wait = WaitList()) {
+		return detail::rect_downloader<T, Method>{}(detail::instance_of(queue), queue, source_buffer, source_buffer_size, source_box, linearized_host_data_target, Pitch::packed(source_box.extent), wait, true);
+	}
+
+	/**
+	 * @brief Downloads a box into host memory with the given row and slice pitch, without unpacking it afterwards.
+	 *
+	 * "host_data_target" points to the first element of the box. The pitches must be at least as large as a row and a slice of the box.
+	 */
+	template<typename T, typename Method = Automatic>
+	cl_event download_rect(cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *host_data_target, const Pitch& host_pitch, const WaitList& wait = WaitList()) {
+		return detail::rect_downloader<T, Method>{}(detail::instance_of(queue), queue, source_buffer, source_buffer_size, source_box, host_data_target, host_pitch, wait, true);
+	}
+
+	/// Downloads a box into a host grid of extent "host_size", in which the box starts at "host_origin".
+	template<typename T, typename Method = Automatic>
+	cl_event download_rect(cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *host_grid, const Extent& host_size, const Point& host_origin, const WaitList& wait = WaitList()) {
+		T* host_data_target = host_grid + host_size.row_offset(host_origin.y, host_origin.z) + host_origin.x;
+		return download_rect<T, Method>(queue, source_buffer, source_buffer_size, source_box, host_data_target, Pitch::of(host_size), wait);
+	}
+
+	/// Fire-and-forget download_rect, see NoEvent. The data has arrived once the queue has been finished.
+	template<typename T, typename Method = Automatic>
+	void download_rect(NoEvent, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *linearized_host_data_target, const WaitList& wait = WaitList()) {
+		detail::rect_downloader<T, Method>{}(detail::instance_of(queue), queue, source_buffer, source_buffer_size, source_box, linearized_host_data_target, Pitch::packed(source_box.extent), wait, false);
+	}
+
+	template<typename T, typename Method = Automatic>
+	void download_rect(NoEvent, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *host_data_target, const Pitch& host_pitch, const WaitList& wait = WaitList()) {
+		detail::rect_downloader<T, Method>{}(detail::instance_of(queue), queue, source_buffer, source_buffer_size, source_box, host_data_target, host_pitch, wait, false);
+	}
+
+	template<typename T, typename Method = Automatic>
+	void download_rect(NoEvent, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, T *host_grid, const Extent& host_size, const Point& host_origin, const WaitList& wait = WaitList()) {
+		T* host_data_target = host_grid + host_size.row_offset(host_origin.y, host_origin.z) + host_origin.x;
+		download_rect<T, Method>(no_event, queue, source_buffer, source_buffer_size, source_box, host_data_target, Pitch::of(host_size), wait);
+	}
+
+
+	/// Device copy functions ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	namespace detail {
+		template<typename T, typename Method = Automatic>
+		struct rect_copier {
+			cl_event operator()(cl_rul_context& lib, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, cl_mem target_buffer, const Extent& target_buffer_size, const Point& target_origin, const WaitList& wait, bool want_event);
+		};
+
+		template<typename T>
+		struct rect_copier<T, Individual> {
+			cl_event operator()(cl_rul_context&, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, cl_mem target_buffer, const Extent& target_buffer_size, const Point& target_origin, const WaitList& wait, bool want_event) {
+				cl_event ev_ret = nullptr;
+				// rows may complete in any order on an out-of-order queue, so all of them are joined
+				const bool out_of_order = want_event && is_out_of_order(queue);
+				std::vector<cl_event> row_events;
+				cl_event row_event;
+
+				const Point& o = source_box.origin;
+				const Extent& e = source_box.extent;
+				const Point& t = target_origin;
+
+				for(size_t z = 0; z < e.zs; z++) {
+					for(size_t y = 0; y < e.ys; y++) {
+						bool last = z == e.zs - 1 && y == e.ys - 1;
+						size_t src_offset = source_buffer_size.row_offset(o.y + y, o.z + z) + o.x;
+						size_t trg_offset = target_buffer_size.row_offset(t.y + y, t.z + z) + t.x;
+						cl_int errcode = clEnqueueCopyBuffer(queue, source_buffer, target_buffer, src_offset * sizeof(T), trg_offset * sizeof(T), e.xs * sizeof(T), wait.count, wait.events, out_of_order ? &row_event : (last && want_event ? &ev_ret : NULL));
+						if(out_of_order) row_events.push_back(row_event);
+						CLU_ERRCHECK(errcode, "cl_rect_update_lib - copy_rect: error enqueueing individual copy");
+					}
+				}
+
+				if(!row_events.empty()) ev_ret = enqueue_join(queue, row_events);
+				return ev_ret;
+			}
+		};
+
+		template<typename T>
+		struct rect_copier<T, ClRect> {
+			cl_event operator()(cl_rul_context&, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, cl_mem target_buffer, const Extent& target_buffer_size, const Point& target_origin, const WaitList& wait, bool want_event) {
+				cl_event ev_ret = nullptr;
+
+				const Point& o = source_box.origin;
+				const Extent& e = source_box.extent;
+				const Point& t = target_origin;
+
+				const size_t src_origin[3] = { o.x * sizeof(T), o.y, o.z };
+				const size_t dst_origin[3] = { t.x * sizeof(T), t.y, t.z };
+				const size_t region[3] = { e.xs * sizeof(T), e.ys, e.zs };
+				cl_int errcode = clEnqueueCopyBufferRect(queue, source_buffer, target_buffer,
+					src_origin, dst_origin, region,
+					source_buffer_size.xs * sizeof(T), source_buffer_size.slice_size() * sizeof(T),
+					target_buffer_size.xs * sizeof(T), target_buffer_size.slice_size() * sizeof(T),
+					wait.count, wait.events, want_event ? &ev_ret : NULL);
+				CLU_ERRCHECK(errcode, "cl_rect_update_lib - copy_rect: error enqueueing clrect copy");
+
+				return ev_ret;
+			}
+		};
+
+		/// Enqueues Copy3D from "source_box" to the box of the same extent at "target_origin", for 2D and 3D boxes alike.
+		template<typename T>
+		cl_event enqueue_copy_kernel(cl_rul_context& lib, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, cl_mem target_buffer, const Extent& target_buffer_size, const Point& target_origin, const WaitList& wait) {
+			const Point& o = source_box.origin;
+			const Extent& e = source_box.extent;
+			const Point& t = target_origin;
+
+			// parameters:
+			//		__global v_t *src, __global v_t *trg,
+			//		uint src_x, uint src_y, uint src_z,
+			//		uint trg_x, uint trg_y, uint trg_z,
+			//		uint size_x, uint size_y, uint size_z,
+			//		uint src_stride, uint src_slice_stride,
+			//		uint trg_stride, uint trg_slice_stride
+
+			cl_kernel kernel = get_transfer_kernel<T>(lib, kernel_id::Copy3D);
+
+			cl_event ev_kernel;
+			cl_uint src_x = static_cast<cl_uint>(o.x), src_y = static_cast<cl_uint>(o.y), src_z = static_cast<cl_uint>(o.z);
+			cl_uint trg_x = static_cast<cl_uint>(t.x), trg_y = static_cast<cl_uint>(t.y), trg_z = static_cast<cl_uint>(t.z);
+			cl_uint size_x = static_cast<cl_uint>(e.xs), size_y = static_cast<cl_uint>(e.ys), size_z = static_cast<cl_uint>(e.zs);
+			cl_uint src_stride = static_cast<cl_uint>(source_buffer_size.xs), src_slice_stride = static_cast<cl_uint>(source_buffer_size.slice_size());
+			cl_uint trg_stride = static_cast<cl_uint>(target_buffer_size.xs), trg_slice_stride = static_cast<cl_uint>(target_buffer_size.slice_size());
+			cluSetKernelArguments(kernel, 15,
+				sizeof(cl_mem), &source_buffer, sizeof(cl_mem), &target_buffer,
+				sizeof(cl_uint), &src_x, sizeof(cl_uint), &src_y, sizeof(cl_uint), &src_z,
+				sizeof(cl_uint), &trg_x, sizeof(cl_uint), &trg_y, sizeof(cl_uint), &trg_z,
+				sizeof(cl_uint), &size_x, sizeof(cl_uint), &size_y, sizeof(cl_uint), &size_z,
+				sizeof(cl_uint), &src_stride, sizeof(cl_uint), &src_slice_stride,
+				sizeof(cl_uint), &trg_stride, sizeof(cl_uint), &trg_slice_stride);
+			const transfer_ndrange range = make_transfer_ndrange(e);
+			cl_int errcode = clEnqueueNDRangeKernel(queue, kernel, 3, NULL, range.global, range.local, wait.count, wait.events, &ev_kernel);
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing copy kernel");
+
+			return ev_kernel;
+		}
+
+		template<typename T>
+		struct rect_copier<T, Kernel> {
+			cl_event operator()(cl_rul_context& lib, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, cl_mem target_buffer, const Extent& target_buffer_size, const Point& target_origin, const WaitList& wait, bool want_event) {
+				const Box target_box = { target_origin, source_box.extent };
+
+				// if the box is contiguous in both buffers, just use a simple copy
+				if(is_linear(source_buffer_size, source_box) && is_linear(target_buffer_size, target_box)) {
+					const Point& o = source_box.origin;
+					const Point& t = target_origin;
+					const size_t src_offset = source_buffer_size.row_offset(o.y, o.z) + o.x;
+					const size_t trg_offset = target_buffer_size.row_offset(t.y, t.z) + t.x;
+					cl_event ev_ret = nullptr;
+					cl_int errcode = clEnqueueCopyBuffer(queue, source_buffer, target_buffer, src_offset * sizeof(T), trg_offset * sizeof(T), source_box.size() * sizeof(T), wait.count, wait.events, want_event ? &ev_ret : NULL);
+					CLU_ERRCHECK(errcode, "cl_rect_update_lib - copy_rect: error enqueueing linear copy");
+					return ev_ret;
+				}
+
+				// otherwise use the copy kernel, as soon as it has been compiled
+				if(!program_ready<T>(lib, false)) return rect_copier<T, ClRect>()(lib, queue, source_buffer, source_buffer_size, source_box, target_buffer, target_buffer_size, target_origin, wait, want_event);
+				return return_event(queue, enqueue_copy_kernel<T>(lib, queue, source_buffer, source_buffer_size, source_box, target_buffer, target_buffer_size, target_origin, wait), want_event);
+			}
+		};
+
+		/// Maps the ranges enclosing both boxes and copies the rows on the host, see rect_uploader<T, Mapped>. Only worthwhile on
+		/// devices with host unified memory, and never chosen by the Automatic method. Within one buffer, the enclosing ranges
+		/// must not overlap either.
+		template<typename T>
+		struct rect_copier<T, Mapped> {
+			cl_event operator()(cl_rul_context&, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, cl_mem target_buffer, const Extent& target_buffer_size, const Point& target_origin, const WaitList& wait, bool want_event) {
+				const Box target_box = { target_origin, source_box.extent };
+				size_t src_offset, src_count, trg_offset, trg_count;
+				enclosing_range(source_buffer_size, source_box, src_offset, src_count);
+				enclosing_range(target_buffer_size, target_box, trg_offset, trg_count);
+				// the gaps between rows must survive the map unless the box is contiguous
+				const cl_map_flags flags = is_linear(target_buffer_size, target_box) ? CL_MAP_WRITE_INVALIDATE_REGION : CL_MAP_WRITE;
+
+				cl_int errcode = CL_SUCCESS;
+				const T* src = static_cast<const T*>(clEnqueueMapBuffer(queue, source_buffer, CL_TRUE, CL_MAP_READ, src_offset * sizeof(T), src_count * sizeof(T), wait.count, wait.events, NULL, &errcode));
+				CLU_ERRCHECK(errcode, "cl_rect_update_lib - copy_rect: error mapping source buffer");
+				T* trg = static_cast<T*>(clEnqueueMapBuffer(queue, target_buffer, CL_TRUE, flags, trg_offset * sizeof(T), trg_count * sizeof(T), wait.count, wait.events, NULL, &errcode));
+				CLU_ERRCHECK(errcode, "cl_rect_update_lib - copy_rect: error mapping target buffer");
+				host::copy_box(trg, Pitch::of(target_buffer_size), src, Pitch::of(source_buffer_size), source_box.extent);
+
+				cl_event ev_ret = nullptr;
+				errcode = clEnqueueUnmapMemObject(queue, source_buffer, const_cast<T*>(src), 0, NULL, NULL);
+				CLU_ERRCHECK(errcode, "cl_rect_update_lib - copy_rect: error unmapping source buffer");
+				errcode = clEnqueueUnmapMemObject(queue, target_buffer, trg, 0, NULL, want_event ? &ev_ret : NULL);
+				CLU_ERRCHECK(errcode, "cl_rect_update_lib - copy_rect: error unmapping target buffer");
+				return ev_ret;
+			}
+		};
+
+		template<typename T>
+		struct rect_copier<T, Automatic> {
+			cl_event operator()(cl_rul_context& lib, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, cl_mem target_buffer, const Extent& target_buffer_size, const Point& target_origin, const WaitList& wait, bool want_event) {
+				// contiguous boxes are always a single linear copy, which the Kernel method handles
+				if(is_linear(source_buffer_size, source_box) && is_linear(target_buffer_size, { target_origin, source_box.extent })) {
+					return rect_copier<T, Kernel>()(lib, queue, source_buffer, source_buffer_size, source_box, target_buffer, target_buffer_size, target_origin, wait, want_event);
+				}
+				switch(select_method(lib.get_cost_model().copy, source_box, sizeof(T))) {
+				case method_id::Individual: return rect_copier<T, Individual>()(lib, queue, source_buffer, source_buffer_size, source_box, target_buffer, target_buffer_size, target_origin, wait, want_event);
+				case method_id::ClRect: return rect_copier<T, ClRect>()(lib, queue, source_buffer, source_buffer_size, source_box, target_buffer, target_buffer_size, target_origin, wait, want_event);
+				default: return rect_copier<T, Kernel>()(lib, queue, source_buffer, source_buffer_size, source_box, target_buffer, target_buffer_size, target_origin, wait, want_event);
+				}
+			}
+		};
+
+		template<typename T>
+		struct rect_copier<T, Runtime> {
+			cl_event operator()(cl_rul_context& lib, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, cl_mem target_buffer, const Extent& target_buffer_size, const Point& target_origin, const WaitList& wait, bool want_event) {
+				if(is_linear(source_buffer_size, source_box) && is_linear(target_buffer_size, { target_origin, source_box.extent })) {
+					return rect_copier<T, Kernel>()(lib, queue, source_buffer, source_buffer_size, source_box, target_buffer, target_buffer_size, target_origin, wait, want_event);
+				}
+				// no samples while the kernels compile, the Kernel method would be timed as ClRect
+				if(!program_ready<T>(lib, false)) {
+					return rect_copier<T, ClRect>()(lib, queue, source_buffer, source_buffer_size, source_box, target_buffer, target_buffer_size, target_origin, wait, want_event);
+				}
+				return tuned_transfer(queue, lib.get_copy_tuner(), lib.get_cost_model().copy, source_box, sizeof(T), wait, want_event, [&](method_id m, bool want) {
+					switch(m) {
+					case method_id::Individual: return rect_copier<T, Individual>()(lib, queue, source_buffer, source_buffer_size, source_box, target_buffer, target_buffer_size, target_origin, wait, want);
+					case method_id::ClRect: return rect_copier<T, ClRect>()(lib, queue, source_buffer, source_buffer_size, source_box, target_buffer, target_buffer_size, target_origin, wait, want);
+					default: return rect_copier<T, Kernel>()(lib, queue, source_buffer, source_buffer_size, source_box, target_buffer, target_buffer_size, target_origin, wait, want);
+					}
+				});
+			}
+		};
+	}
+
+	/**
+	 * @brief Copies "source_box" of "source_buffer" to the box of the same extent at "target_origin" in "target_buffer", on the device.
+	 *
+	 * The buffers may have different extents (re-tiling, sub-domain extraction, resizing). They may also be the same buffer, as
+	 * long as the boxes do not overlap.
+	 */
+	template<typename T, typename Method = Automatic>
+	cl_event copy_rect(cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, cl_mem target_buffer, const Extent& target_buffer_size, const Point& target_origin, const WaitList& wait = WaitList()) {
+		return detail::rect_copier<T, Method>{}(detail::instance_of(queue), queue, source_buffer, source_buffer_size, source_box, target_buffer, target_buffer_size, target_origin, wait, true);
+	}
+
+	/// Fire-and-forget copy_rect, see NoEvent.
+	template<typename T, typename Method = Automatic>
+	void copy_rect(NoEvent, cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box& source_box, cl_mem target_buffer, const Extent& target_buffer_size, const Point& target_origin, const WaitList& wait = WaitList()) {
+		detail::rect_copier<T, Method>{}(detail::instance_of(queue), queue, source_buffer, source_buffer_size, source_box, target_buffer, target_buffer_size, target_origin, wait, false);
+	}
+
+
+	/// Batched transfers ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	namespace detail {
+
+		constexpr size_t BATCH_DESCRIPTOR_SIZE = 8;
+
+		/// Descriptor table read by the batch kernels, see kernel_code.h. Returns the number of work-groups to launch.
+		inline size_t make_batch_table(const Box* boxes, size_t num_boxes, std::vector<cl_uint>& table) {
+			size_t groups = 0;
+			size_t staging_offset = 0;
+			for(size_t b = 0; b < num_boxes; ++b) {
+				const Point& o = boxes[b].origin;
+				const Extent& e = boxes[b].extent;
+				if(boxes[b].size() == 0) continue;
+				const size_t rows_per_group = std::max<size_t>(1, TILED_ELEMENTS_PER_GROUP / e.xs);
+				const size_t entry[BATCH_DESCRIPTOR_SIZE] = { o.x, o.y, o.z, e.xs, e.ys, rows_per_group, groups, staging_offset };
+				for(size_t v : entry) {
+					assert(v <= std::numeric_limits<cl_uint>::max() && "cl_rect_update_lib - batch descriptor exceeds the 32 bit range of the kernels");
+					table.push_back(static_cast<cl_uint>(v));
+				}
+				groups += (e.ys + rows_per_group - 1) / rows_per_group * e.zs;
+				staging_offset += e.size();
+			}
+			// the kernels address the whole staged data and launch range with 32 bit indices
+			assert(staging_offset <= std::numeric_limits<cl_uint>::max() && groups <= std::numeric_limits<cl_uint>::max() && "cl_rect_update_lib - batch exceeds the 32 bit range of the kernels");
+			return groups;
+		}
+
+		inline void CL_CALLBACK free_host_table(cl_event, cl_int, void* user_data) {
+			delete static_cast<std::vector<cl_uint>*>(user_data);
+		}
+
+		/// Enqueues a non-blocking write of "table" to "buffer" and takes ownership of it: the table must outlive the write,
+		/// so it is freed by a callback once the write has completed. Returns the event of the write.
+		inline cl_event enqueue_table_write(cl_command_queue queue, cl_mem buffer, size_t offset, std::vector<cl_uint>* table, const WaitList& wait) {
+			cl_event ev_table;
+			cl_int errcode = clEnqueueWriteBuffer(queue, buffer, CL_FALSE, offset, table->size() * sizeof(cl_uint), table->data(), wait.count, wait.events, &ev_table);
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing table transfer");
+			errcode = clSetEventCallback(ev_table, CL_COMPLETE, free_host_table, table);
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error setting table transfer callback");
+			return ev_table;
+		}
+
+		/// Writes the descriptor table of "boxes" to a staging buffer and enqueues the batch kernel "id" between "src_buffer" and "trg_buffer".
+		/// The kernel waits for "wait" and the table.
+		template<typename T>
+		cl_event enqueue_batch_kernel(cl_rul_context& lib, cl_command_queue queue, kernel_id id, cl_mem src_buffer, cl_mem trg_buffer, const Extent& buffer_size, const Box* boxes, size_t num_boxes, const WaitList& wait) {
+			std::vector<cl_uint>* table = new std::vector<cl_uint>();
+			const size_t groups = make_batch_table(boxes, num_boxes, *table);
+			const size_t table_size = table->size() * sizeof(cl_uint);
+			cl_mem table_buffer = lib.acquire_staging_buffer(table_size);
+			std::vector<cl_event> kernel_wait(wait.events, wait.events + wait.count);
+			kernel_wait.push_back(enqueue_table_write(queue, table_buffer, 0, table, WaitList()));
+
+			// parameters:
+			//		__global v_t *src, __global v_t *trg,
+			//		__global const uint *boxes, uint num_boxes,
+			//		uint stride, uint slice_stride
+
+			cl_kernel kernel = get_transfer_kernel<T>(lib, id);
+			cl_uint num_entries = static_cast<cl_uint>(table_size / (BATCH_DESCRIPTOR_SIZE * sizeof(cl_uint)));
+			assert(buffer_size.slice_size() <= std::numeric_limits<cl_uint>::max() && "cl_rect_update_lib - buffer slice exceeds the 32 bit range of the kernels");
+			cl_uint stride = static_cast<cl_uint>(buffer_size.xs), slice_stride = static_cast<cl_uint>(buffer_size.slice_size());
+			cluSetKernelArguments(kernel, 6,
+				sizeof(cl_mem), &src_buffer, sizeof(cl_mem), &trg_buffer,
+				sizeof(cl_mem), &table_buffer, sizeof(cl_uint), &num_entries,
+				sizeof(cl_uint), &stride, sizeof(cl_uint), &slice_stride);
+			const size_t local_size = TRANSFER_WORK_GROUP_SIZE;
+			const size_t global_size = groups * local_size;
+			cl_event ev_kernel;
+			cl_int errcode = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, &local_size, static_cast<cl_uint>(kernel_wait.size()), kernel_wait.data(), &ev_kernel);
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing batch kernel");
+			clReleaseEvent(kernel_wait.back());
+			lib.release_staging_buffer(table_buffer, ev_kernel);
+			return ev_kernel;
+		}
+
+		inline size_t total_size(const Box* boxes, size_t num_boxes) {
+			size_t size = 0;
+			for(size_t b = 0; b < num_boxes; ++b) size += boxes[b].size();
+			return size;
+		}
+
+	} // namespace detail
+
+	/**
+	 * @brief Uploads several boxes of one buffer with a single staging transfer and a single kernel launch.
+	 *
+	 * "linearized_host_data_source" holds the linearized boxes one after another, in the order of "target_boxes".
+	 * Returns the event of the kernel, or nullptr if there is nothing to transfer.
+	 */
+	template<typename T>
+	cl_event upload_rects(cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Box* target_boxes, size_t num_boxes, const T *linearized_host_data_source, const WaitList& wait = WaitList()) {
+		detail::cl_rul_context& lib = detail::instance_of(queue);
+		const size_t required_staging_size = detail::total_size(target_boxes, num_boxes) * sizeof(T);
+		if(required_staging_size == 0) return nullptr;
+
+		cl_mem staging_buffer = lib.acquire_staging_buffer(required_staging_size);
+		cl_event ev_staging = detail::enqueue_host_write(lib, queue, staging_buffer, 0, required_staging_size, linearized_host_data_source, wait);
+
+		cl_event ev_kernel = detail::enqueue_batch_kernel<T>(lib, queue, detail::kernel_id::UploadBatch, staging_buffer, target_buffer, target_buffer_size, target_boxes, num_boxes, ev_staging);
+		clReleaseEvent(ev_staging);
+		lib.release_staging_buffer(staging_buffer, ev_kernel);
+		return ev_kernel;
+	}
+
+	/**
+	 * @brief Downloads several boxes of one buffer with a single kernel launch and a single staging transfer.
+	 *
+	 * The boxes are written to "linearized_host_data_target" one after another, in the order of "source_boxes".
+	 * Returns the event of the staging transfer, or nullptr if there is nothing to transfer.
+	 */
+	template<typename T>
+	cl_event download_rects(cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Box* source_boxes, size_t num_boxes, T *linearized_host_data_target, const WaitList& wait = WaitList()) {
+		detail::cl_rul_context& lib = detail::instance_of(queue);
+		const size_t required_staging_size = detail::total_size(source_boxes, num_boxes) * sizeof(T);
+		if(required_staging_size == 0) return nullptr;
+
+		cl_mem staging_buffer = lib.acquire_staging_buffer(required_staging_size);
+		cl_event ev_kernel = detail::enqueue_batch_kernel<T>(lib, queue, detail::kernel_id::DownloadBatch, source_buffer, staging_buffer, source_buffer_size, source_boxes, num_boxes, wait);
+
+		cl_event ev_staging = detail::enqueue_host_read(lib, queue, staging_buffer, 0, required_staging_size, linearized_host_data_target, ev_kernel);
+		clReleaseEvent(ev_kernel);
+		lib.release_staging_buffer(staging_buffer, ev_staging);
+		return ev_staging;
+	}
+
+
+	/// Scatter / gather transfers /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	namespace detail {
+
+		/// Staging layout of scatter and gather transfers: the packed values, padded to whole uints, followed by the indices.
+		template<typename T>
+		size_t index_table_offset(size_t count) {
+			return (count * sizeof(T) + sizeof(cl_uint) - 1) / sizeof(cl_uint);
+		}
+
+		inline std::vector<cl_uint>* make_index_table(const size_t* indices, size_t count, size_t offset) {
+			// the kernels address the table and the buffer with 32 bit indices
+			assert(offset + count <= std::numeric_limits<cl_uint>::max() && "cl_rect_update_lib - index table exceeds the 32 bit range of the kernels");
+			std::vector<cl_uint>* table = new std::vector<cl_uint>(offset + count);
+			for(size_t i = 0; i < count; ++i) {
+				assert(indices[i] <= std::numeric_limits<cl_uint>::max() && "cl_rect_update_lib - scatter/gather index exceeds the 32 bit range of the kernels");
+				(*table)[offset + i] = static_cast<cl_uint>(indices[i]);
+			}
+			return table;
+		}
+
+		/// Enqueues Scatter or Gather for "count" elements, the index table starts "index_offset" uints into the staging side
+		/// ("src_buffer" for Scatter, "trg_buffer" for Gather).
+		template<typename T>
+		cl_event enqueue_index_kernel(cl_rul_context& lib, cl_command_queue queue, kernel_id id, cl_mem src_buffer, cl_mem trg_buffer, size_t index_offset, size_t count, const WaitList& wait) {
+			// parameters:
+			//		__global v_t *src, __global v_t *trg,
+			//		uint index_offset, uint count
+
+			cl_kernel kernel = get_transfer_kernel<T>(lib, id);
+			cl_uint offset_arg = static_cast<cl_uint>(index_offset), count_arg = static_cast<cl_uint>(count);
+			cluSetKernelArguments(kernel, 4,
+				sizeof(cl_mem), &src_buffer, sizeof(cl_mem), &trg_buffer,
+				sizeof(cl_uint), &offset_arg, sizeof(cl_uint), &count_arg);
+			const size_t local_size = TRANSFER_WORK_GROUP_SIZE;
+			const size_t global_size = (count + local_size - 1) / local_size * local_size;
+			cl_event ev_kernel;
+			cl_int errcode = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, &local_size, wait.count, wait.events, &ev_kernel);
+			CLU_ERRCHECK(errcode, "cl_rect_upate_lib - error enqueueing scatter/gather kernel");
+			return ev_kernel;
+		}
+
+		inline std::vector<size_t> linear_indices(const Extent& buffer_size, const Point* points, size_t count) {
+			std::vector<size_t> indices(count);
+			for(size_t i = 0; i < count; ++i) indices[i] = buffer_size.row_offset(points[i].y, points[i].z) + points[i].x;
+			return indices;
+		}
+
+	} // namespace detail
+
+	/**
+	 * @brief Writes "count" packed values to the elements at the given linear indices of "target_buffer".
+	 *
+	 * Values and indices are staged with a single transfer and applied with a single kernel, so the source memory may be
+	 * reused on return. Indices should be distinct, otherwise it is unspecified which value ends up in the element.
+	 * Returns the event of the kernel, or nullptr if "count" is 0.
+	 */
+	template<typename T>
+	cl_event scatter_upload(cl_command_queue queue, cl_mem target_buffer, const size_t* indices, size_t count, const T *values, const WaitList& wait = WaitList()) {
+		detail::cl_rul_context& lib = detail::instance_of(queue);
+		if(count == 0) return nullptr;
+		const size_t index_offset = detail::index_table_offset<T>(count);
+		std::vector<cl_uint>* staged = detail::make_index_table(indices, count, index_offset);
+		std::memcpy(staged->data(), values, count * sizeof(T));
+
+		cl_mem staging_buffer = lib.acquire_staging_buffer(staged->size() * sizeof(cl_uint));
+		cl_event ev_staging = detail::enqueue_table_write(queue, staging_buffer, 0, staged, wait);
+
+		cl_event ev_kernel = detail::enqueue_index_kernel<T>(lib, queue, detail::kernel_id::Scatter, staging_buffer, target_buffer, index_offset, count, ev_staging);
+		clReleaseEvent(ev_staging);
+		lib.release_staging_buffer(staging_buffer, ev_kernel);
+		return ev_kernel;
+	}
+
+	/// scatter_upload for (x,y,z) indices into a buffer of extent "target_buffer_size".
+	template<typename T>
+	cl_event scatter_upload(cl_command_queue queue, cl_mem target_buffer, const Extent& target_buffer_size, const Point* points, size_t count, const T *values, const WaitList& wait = WaitList()) {
+		const std::vector<size_t> indices = detail::linear_indices(target_buffer_size, points, count);
+		return scatter_upload<T>(queue, target_buffer, indices.data(), count, values, wait);
+	}
+
+	/**
+	 * @brief Reads the elements at the given linear indices of "source_buffer" into "count" packed values.
+	 *
+	 * The indices are staged with a single transfer, and the values are collected by a single kernel and read back with
+	 * a single transfer. Returns the event of that read, or nullptr if "count" is 0.
+	 */
+	template<typename T>
+	cl_event gather_download(cl_command_queue queue, cl_mem source_buffer, const size_t* indices, size_t count, T *values, const WaitList& wait = WaitList()) {
+		detail::cl_rul_context& lib = detail::instance_of(queue);
+		if(count == 0) return nullptr;
+		const size_t index_offset = detail::index_table_offset<T>(count);
+		std::vector<cl_uint>* staged = detail::make_index_table(indices, count, 0);
+
+		cl_mem staging_buffer = lib.acquire_staging_buffer((index_offset + count) * sizeof(cl_uint));
+		cl_event ev_table = detail::enqueue_table_write(queue, staging_buffer, index_offset * sizeof(cl_uint), staged, wait);
+
+		cl_event ev_kernel = detail::enqueue_index_kernel<T>(lib, queue, detail::kernel_id::Gather, source_buffer, staging_buffer, index_offset, count, ev_table);
+		clReleaseEvent(ev_table);
+
+		cl_event ev_staging = detail::enqueue_host_read(lib, queue, staging_buffer, 0, count * sizeof(T), values, ev_kernel);
+		clReleaseEvent(ev_kernel);
+		lib.release_staging_buffer(staging_buffer, ev_staging);
+		return ev_staging;
+	}
+
+	/// gather_download for (x,y,z) indices into a buffer of extent "source_buffer_size".
+	template<typename T>
+	cl_event gather_download(cl_command_queue queue, cl_mem source_buffer, const Extent& source_buffer_size, const Point* points, size_t count, T *values, const WaitList& wait = WaitList()) {
+		const std::vector<size_t> indices = detail::linear_indices(source_buffer_size, points, count);
+		return gather_download<T>(queue, source_buffer, indices.data(), count, values, wait);
+	}
+
+
+	/// Halo exchange //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	/// Parts of the halo of a box moved by pack_halo and unpack_halo: its 6 faces, or all 26 faces, edges and corners.
+	enum class halo_parts { Faces, All };
+
+	/// One part of a halo_layout.
+	struct halo_part {
+		int dx, dy, dz; ///< direction from the inner box, each -1, 0 or 1
+		Box boundary;   ///< the outermost layers inside the inner box, read by pack_halo
+		Box ghost;      ///< the layers surrounding the inner box, written by unpack_halo
+		size_t offset;  ///< first element of the part in the packed data
+	};
+
+	/**
+	 * @brief Packed layout of the halo of an inner box with a given width, shared by pack_halo and unpack_halo.
+	 *
+	 * Parts are ordered by increasing dz, then dy, then dx, so the 6 faces are -z, -y, -x, +x, +y, +z. Each part is packed
+	 * row by row, and the parts follow each other without gaps. The boundary and ghost boxes of a part have the same extent.
+	 * Part d of one sub-domain's packed boundary therefore fills part -d of its neighbour's ghost layers, and "find" locates
+	 * that part in the neighbour's layout.
+	 */
+	struct halo_layout {
+		std::vector<halo_part> parts;
+		size_t size = 0; ///< total elements of all parts
+
+		/// Index of the part of direction (dx, dy, dz) in "parts", -1 if the layout does not include it.
+		int find(int dx, int dy, int dz) const {
+			for(size_t i = 0; i < parts.size(); ++i) {
+				if(parts[i].dx == dx && parts[i].dy == dy && parts[i].dz == dz) return static_cast<int>(i);
+			}
+			return -1;
+		}
+	};
+
+	inline halo_layout make_halo_layout(const Box& inner, size_t width, halo_parts which = halo_parts::Faces) {
+		// range along one axis of the part in direction d, inside or outside of [o, o + e)
+		auto range = [width](int d, size_t o, size_t e, bool ghost, size_t& out_origin, size_t& out_extent) {
+			out_extent = d == 0 ? e : width;
+			if(d == 0) out_origin = o;
+			else if(d < 0) out_origin = ghost ? o - width : o;
+			else out_origin = ghost ? o + e : o + e - width;
+		};
+
+		halo_layout layout;
+		for(int dz = -1; dz <= 1; ++dz) {
+			for(int dy = -1; dy <= 1; ++dy) {
+				for(int dx = -1; dx <= 1; ++dx) {
+					const int axes = (dx != 0) + (dy != 0) + (dz != 0);
+					if(axes == 0 || (which == halo_parts::Faces && axes > 1)) continue;
+					halo_part part = { dx, dy, dz, inner, inner, layout.size };
+					for(bool ghost : { false, true }) {
+						Box& b = ghost ? part.ghost : part.boundary;
+						range(dx, inner.origin.x, inner.extent.xs, ghost, b.origin.x, b.extent.xs);
+						range(dy, inner.origin.y, inner.extent.ys, ghost, b.origin.y, b.extent.ys);
+						range(dz, inner.origin.z, inner.extent.zs, ghost, b.origin.z, b.extent.zs);
+					}
+					layout.size += part.boundary.size();
+					layout.parts.push_back(part);
+				}
+			}
+		}
+		return layout;
+	}
+
+	namespace detail {
+		inline std::vector<Box> halo_boxes(const halo_layout& layout, bool ghost) {
+			std::vector<Box> boxes;
+			for(const halo_part& part : layout.parts) boxes.push_back(ghost ? part.ghost : part.boundary);
+			return boxes;
+		}
+	}
+
+	/**
+	 * @brief Reads the boundary parts of "layout" from "buffer" into "packed_host_target", laid out as described by halo_layout.
+	 *
+	 * All parts are gathered by a single batch kernel and read back with a single transfer, see download_rects.
+	 * Returns the event of that read, or nullptr if the halo is empty.
+	 */
+	template<typename T>
+	cl_event pack_halo(cl_command_queue queue, cl_mem buffer, const Extent& buffer_size, const halo_layout& layout, T *packed_host_target, const WaitList& wait = WaitList()) {
+		const std::vector<Box> boxes = detail::halo_boxes(layout, false);
+		return download_rects<T>(queue, buffer, buffer_size, boxes.data(), boxes.size(), packed_host_target, wait);
+	}
+
+	/// pack_halo of the parts "which" of the halo of width "width" around "inner".
+	template<typename T>
+	cl_event pack_halo(cl_command_queue queue, cl_mem buffer, const Extent& buffer_size, const Box& inner, size_t width, halo_parts which, T *packed_host_target, const WaitList& wait = WaitList()) {
+		return pack_halo<T>(queue, buffer, buffer_size, make_halo_layout(inner, width, which), packed_host_target, wait);
+	}
+
+	/**
+	 * @brief Writes "packed_host_source", laid out as described by halo_layout, to the ghost parts of "layout" in "buffer".
+	 *
+	 * The ghost layers must lie within the buffer. The data is staged with a single transfer and scattered by a single batch
+	 * kernel, see upload_rects. Returns the event of that kernel, or nullptr if the halo is empty.
+	 */
+	template<typename T>
+	cl_event unpack_halo(cl_command_queue queue, cl_mem buffer, const Extent& buffer_size, const halo_layout& layout, const T *packed_host_source, const WaitList& wait = WaitList()) {
+		const std::vector<Box> boxes = detail::halo_boxes(layout, true);
+		for(const Box& b : boxes) {
+			// an inner box closer to the buffer start than "width" wraps the ghost origin around, past the end
+			assert((b.size() == 0 || (b.origin.x < buffer_size.xs && b.origin.y < buffer_size.ys && b.origin.z < buffer_size.zs
+				&& b.origin.x + b.extent.xs <= buffer_size.xs && b.origin.y + b.extent.ys <= buffer_size.ys && b.origin.z + b.extent.zs <= buffer_size.zs))
+				&& "cl_rect_update_lib - unpack_halo: ghost layers outside of the buffer");
+		}
+		return upload_rects<T>(queue, buffer, buffer_size, boxes.data(), boxes.size(), packed_host_source, wait);
+	}
+
+	/// unpack_halo of the parts "which" of the halo of width "width" around "inner".
+	template<typename T>
+	cl_event unpack_halo(cl_command_queue queue, cl_mem buffer, const Extent& buffer_size, const Box& inner, size_t width, halo_parts which, const T *packed_host_source, const WaitList& wait = WaitList()) {
+		return unpack_halo<T>(queue, buffer, buffer_size, make_halo_layout(inner, width, which), packed_host_source, wait);
+	}
+
+
+	/// Cost model calibration ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	namespace detail {
+
+		constexpr size_t CALIBRATION_WIDTH = 2048;
+		constexpr size_t CALIBRATION_ROWS = 512;
+		constexpr size_t CALIBRATION_BLOCK_ROWS = 256;
+		constexpr int CALIBRATION_REPETITIONS = 5;
+
+		/// Minimum wall clock time in microseconds of a transfer including its completion.
+		template<typename F>
+		double time_transfer(cl_command_queue queue, F transfer) {
+			double best = std::numeric_limits<double>::infinity();
+			for(int r = 0; r < CALIBRATION_REPETITIONS; ++r) {
+				auto start = std::chrono::high_resolution_clock::now();
+				cl_event ev = transfer();
+				clFinish(queue);
+				auto end = std::chrono::high_resolution_clock::now();
+				if(ev) clReleaseEvent(ev);
+				best = std::min(best, std::chrono::duration<double, std::micro>(end - start).count());
+			}
+			return best;
+		}
+
+		/// Fits the cost of one method from a single element, a column and a large block.
+		template<typename F>
+		method_cost fit_method_cost(cl_command_queue queue, F transfer) {
+			const Box single = { { 0u,0u,0u },{ 1u,1u,1u } };
+			const Box column = { { 0u,0u,0u },{ 1u,CALIBRATION_ROWS,1u } };
+			const Box block = { { 0u,0u,0u },{ CALIBRATION_WIDTH / 2,CALIBRATION_BLOCK_ROWS,1u } };
+
+			// warm up, this also builds the kernels and allocates the staging buffer
+			cl_event ev = transfer(block);
+			clFinish(queue);
+			if(ev) clReleaseEvent(ev);
+
+			const double t_single = time_transfer(queue, [&] { return transfer(single); });
+			const double t_column = time_transfer(queue, [&] { return transfer(column); });
+			const double t_block = time_transfer(queue, [&] { return transfer(block); });
+
+			method_cost ret;
+			ret.row_cost = std::max(0.0, (t_column - t_single) / (CALIBRATION_ROWS - 1));
+			ret.latency = std::max(0.0, t_single - ret.row_cost);
+			const double t_bytes = t_block - ret.latency - CALIBRATION_BLOCK_ROWS * ret.row_cost;
+			ret.bandwidth = block.size() * sizeof(cl_float) / std::max(t_bytes, 1.0);
+			return ret;
+		}
+
+		inline cost_model measure_cost_model(cl_rul_context& lib) {
+			cl_int errcode = CL_SUCCESS;
+			cl_command_queue queue = clCreateCommandQueue(lib.get_cl_context(), lib.get_cl_device_id(), 0, &errcode);
+			CLU_ERRCHECK(errcode, "cl_rect_update_lib - error creating calibration queue");
+
+			const Extent full_e = { CALIBRATION_WIDTH, CALIBRATION_ROWS, 1u };
+			std::vector<cl_float> host(full_e.size());
+			cl_mem buffer = clCreateBuffer(lib.get_cl_context(), CL_MEM_READ_WRITE, full_e.size() * sizeof(cl_float), nullptr, &errcode);
+			CLU_ERRCHECK(errcode, "cl_rect_update_lib - error allocating calibration buffer");
+			cl_mem copy_buffer = clCreateBuffer(lib.get_cl_context(), CL_MEM_READ_WRITE, full_e.size() * sizeof(cl_float), nullptr, &errcode);
+			CLU_ERRCHECK(errcode, "cl_rect_update_lib - error allocating calibration buffer");
+
+			cost_model model;
+			model.upload.individual = fit_method_cost(queue, [&](const Box& b) { return rect_uploader<cl_float, Individual>()(lib, queue, buffer, full_e, b, host.data(), Pitch::packed(b.extent), WaitList(), true); });
+			model.upload.clrect = fit_method_cost(queue, [&](const Box& b) { return rect_uploader<cl_float, ClRect>()(lib, queue, buffer, full_e, b, host.data(), Pitch::packed(b.extent), WaitList(), true); });
+			model.upload.kernel = fit_method_cost(queue, [&](const Box& b) { return upload_rect_kernel_2D<cl_float>(lib, queue, buffer, full_e, b, host.data(), Pitch::packed(b.extent), WaitList()); });
+			model.download.individual = fit_method_cost(queue, [&](const Box& b) { return rect_downloader<cl_float, Individual>()(lib, queue, buffer, full_e, b, host.data(), Pitch::packed(b.extent), WaitList(), true); });
+			model.download.clrect = fit_method_cost(queue, [&](const Box& b) { return rect_downloader<cl_float, ClRect>()(lib, queue, buffer, full_e, b, host.data(), Pitch::packed(b.extent), WaitList(), true); });
+			model.download.kernel = fit_method_cost(queue, [&](const Box& b) { return download_rect_kernel_2D<cl_float>(lib, queue, buffer, full_e, b, host.data(), Pitch::packed(b.extent), WaitList()); });
+			model.copy.individual = fit_method_cost(queue, [&](const Box& b) { return rect_copier<cl_float, Individual>()(lib, queue, buffer, full_e, b, copy_buffer, full_e, b.origin, WaitList(), true); });
+			model.copy.clrect = fit_method_cost(queue, [&](const Box& b) { return rect_copier<cl_float, ClRect>()(lib, queue, buffer, full_e, b, copy_buffer, full_e, b.origin, WaitList(), true); });
+			model.copy.kernel = fit_method_cost(queue, [&](const Box& b) { return enqueue_copy_kernel<cl_float>(lib, queue, buffer, full_e, b, copy_buffer, full_e, b.origin, WaitList()); });
+
+			clReleaseMemObject(copy_buffer);
+			clReleaseMemObject(buffer);
+			clReleaseCommandQueue(queue);
+			return model;
+		}
+
+	} // namespace detail
+
+} // namespace cl_rul
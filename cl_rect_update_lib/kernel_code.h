@@ -2,11 +2,19 @@
 namespace cl_rul {
 	namespace kernels {
 
+		// All transfer kernels are launched on a (padded) NDRange covering the box, with
+		// dimension 0 mapping to columns, 1 to rows and 2 to slices.
+		// Kernels built with the same options are concatenated into one program, so shared
+		// definitions are guarded.
+
 		constexpr const char* upload_2D = R"(
 			#pragma OPENCL EXTENSION cl_khr_byte_addressable_store : enable
 			#pragma OPENCL EXTENSION cl_khr_fp64: enable
 
+			#ifndef V_T_DEFINED
+			#define V_T_DEFINED
 			typedef struct { T x[NUM]; } v_t;
+			#endif
 
 			__kernel void upload_2D(
 				__global v_t *src, __global v_t *trg,
@@ -14,10 +22,10 @@ namespace cl_rul {
 				uint size_x, uint size_y,
 				uint stride)
 			{
-				int i = get_global_id(0);
-				int line = i/size_x + pos_y;
-				int col = i%size_x + pos_x;
-				trg[col + line*stride] = src[i];
+				uint col = get_global_id(0);
+				uint line = get_global_id(1);
+				if(col >= size_x || line >= size_y) return;
+				trg[col + pos_x + (size_t)(line + pos_y)*stride] = src[col + (size_t)line*size_x];
 			}
 		)";
 
@@ -25,7 +33,10 @@ namespace cl_rul {
 			#pragma OPENCL EXTENSION cl_khr_byte_addressable_store : enable
 			#pragma OPENCL EXTENSION cl_khr_fp64: enable
 
+			#ifndef V_T_DEFINED
+			#define V_T_DEFINED
 			typedef struct { T x[NUM]; } v_t;
+			#endif
 
 			__kernel void download_2D(
 				__global v_t *src, __global v_t *trg,
@@ -33,10 +44,352 @@ namespace cl_rul {
 				uint size_x, uint size_y,
 				uint stride)
 			{
-				int i = get_global_id(0);
-				int line = i/size_x + pos_y;
-				int col = i%size_x + pos_x;
-				trg[i] = src[col + line*stride];
+				uint col = get_global_id(0);
+				uint line = get_global_id(1);
+				if(col >= size_x || line >= size_y) return;
+				trg[col + (size_t)line*size_x] = src[col + pos_x + (size_t)(line + pos_y)*stride];
+			}
+		)";
+
+		constexpr const char* upload_3D = R"(
+			#pragma OPENCL EXTENSION cl_khr_byte_addressable_store : enable
+			#pragma OPENCL EXTENSION cl_khr_fp64: enable
+
+			#ifndef V_T_DEFINED
+			#define V_T_DEFINED
+			typedef struct { T x[NUM]; } v_t;
+			#endif
+
+			__kernel void upload_3D(
+				__global v_t *src, __global v_t *trg,
+				uint pos_x, uint pos_y, uint pos_z,
+				uint size_x, uint size_y, uint size_z,
+				uint stride, uint slice_stride)
+			{
+				uint col = get_global_id(0);
+				uint line = get_global_id(1);
+				uint slice = get_global_id(2);
+				if(col >= size_x || line >= size_y) return;
+				size_t src_idx = col + ((size_t)slice*size_y + line)*size_x;
+				trg[col + pos_x + (size_t)(line + pos_y)*stride + (size_t)(slice + pos_z)*slice_stride] = src[src_idx];
+			}
+		)";
+
+		constexpr const char* download_3D = R"(
+			#pragma OPENCL EXTENSION cl_khr_byte_addressable_store : enable
+			#pragma OPENCL EXTENSION cl_khr_fp64: enable
+
+			#ifndef V_T_DEFINED
+			#define V_T_DEFINED
+			typedef struct { T x[NUM]; } v_t;
+			#endif
+
+			__kernel void download_3D(
+				__global v_t *src, __global v_t *trg,
+				uint pos_x, uint pos_y, uint pos_z,
+				uint size_x, uint size_y, uint size_z,
+				uint stride, uint slice_stride)
+			{
+				uint col = get_global_id(0);
+				uint line = get_global_id(1);
+				uint slice = get_global_id(2);
+				if(col >= size_x || line >= size_y) return;
+				size_t trg_idx = col + ((size_t)slice*size_y + line)*size_x;
+				trg[trg_idx] = src[col + pos_x + (size_t)(line + pos_y)*stride + (size_t)(slice + pos_z)*slice_stride];
+			}
+		)";
+
+		// Strip kernels for narrow boxes (size_x much smaller than size_y): every work-group moves rows_per_group
+		// consecutive rows, which form a contiguous tile of the staging buffer. All work-items of a group walk that
+		// tile with a stride of the group size, so staging accesses are fully coalesced, row segments are covered by
+		// consecutive work-items and no lanes are lost to padding size_x up to a power of two.
+		// Row and column are advanced incrementally, avoiding a division per element.
+
+		constexpr const char* upload_tiled_2D = R"(
+			#pragma OPENCL EXTENSION cl_khr_byte_addressable_store : enable
+			#pragma OPENCL EXTENSION cl_khr_fp64: enable
+
+			#ifndef V_T_DEFINED
+			#define V_T_DEFINED
+			typedef struct { T x[NUM]; } v_t;
+			#endif
+
+			__kernel void upload_tiled_2D(
+				__global v_t *src, __global v_t *trg,
+				uint pos_x, uint pos_y,
+				uint size_x, uint size_y,
+				uint stride, uint rows_per_group)
+			{
+				uint lid = get_local_id(0);
+				uint lsize = get_local_size(0);
+				uint first_row = get_group_id(0) * rows_per_group;
+				uint count = min(rows_per_group, size_y - first_row) * size_x;
+				__global v_t *src_tile = src + (size_t)first_row*size_x;
+				__global v_t *trg_tile = trg + pos_x + (size_t)(first_row + pos_y)*stride;
+
+				uint step_row = lsize / size_x, step_col = lsize % size_x;
+				uint row = lid / size_x, col = lid % size_x;
+				for(uint i = lid; i < count; i += lsize) {
+					trg_tile[col + (size_t)row*stride] = src_tile[i];
+					row += step_row;
+					col += step_col;
+					if(col >= size_x) { col -= size_x; row++; }
+				}
+			}
+		)";
+
+		constexpr const char* download_tiled_2D = R"(
+			#pragma OPENCL EXTENSION cl_khr_byte_addressable_store : enable
+			#pragma OPENCL EXTENSION cl_khr_fp64: enable
+
+			#ifndef V_T_DEFINED
+			#define V_T_DEFINED
+			typedef struct { T x[NUM]; } v_t;
+			#endif
+
+			__kernel void download_tiled_2D(
+				__global v_t *src, __global v_t *trg,
+				uint pos_x, uint pos_y,
+				uint size_x, uint size_y,
+				uint stride, uint rows_per_group)
+			{
+				uint lid = get_local_id(0);
+				uint lsize = get_local_size(0);
+				uint first_row = get_group_id(0) * rows_per_group;
+				uint count = min(rows_per_group, size_y - first_row) * size_x;
+				__global v_t *src_tile = src + pos_x + (size_t)(first_row + pos_y)*stride;
+				__global v_t *trg_tile = trg + (size_t)first_row*size_x;
+
+				uint step_row = lsize / size_x, step_col = lsize % size_x;
+				uint row = lid / size_x, col = lid % size_x;
+				for(uint i = lid; i < count; i += lsize) {
+					trg_tile[i] = src_tile[col + (size_t)row*stride];
+					row += step_row;
+					col += step_col;
+					if(col >= size_x) { col -= size_x; row++; }
+				}
+			}
+		)";
+
+		// Vectorized kernels: T is the scalar type underlying the element type (all x coordinates are given in scalars)
+		// and every work-item moves one slot of VEC scalars of a row with vloadN / vstoreN. Slots are aligned to VEC in
+		// the device buffer, so the unaligned head and tail of each row are peeled into partial slots copied per scalar.
+		// Used for 2D and 3D boxes alike, a 2D box is a single slice.
+
+		constexpr const char* upload_vec = R"(
+			#pragma OPENCL EXTENSION cl_khr_byte_addressable_store : enable
+			#pragma OPENCL EXTENSION cl_khr_fp64: enable
+
+			#define CAT_(a, b) a##b
+			#define CAT(a, b) CAT_(a, b)
+
+			__kernel void upload_vec(
+				__global T *src, __global T *trg,
+				uint pos_x, uint pos_y, uint pos_z,
+				uint size_x, uint size_y, uint size_z,
+				uint stride, uint slice_stride)
+			{
+				uint slot = get_global_id(0);
+				uint line = get_global_id(1);
+				uint slice = get_global_id(2);
+				if(line >= size_y) return;
+				size_t row = pos_x + (size_t)(line + pos_y)*stride + (size_t)(slice + pos_z)*slice_stride;
+				int first = (int)(slot * VEC) - (int)(row % VEC);
+				if(first >= (int)size_x) return;
+				__global T *src_row = src + ((size_t)slice*size_y + line)*size_x;
+				__global T *trg_row = trg + row;
+				if(first >= 0 && first + VEC <= (int)size_x) {
+					CAT(vstore, VEC)(CAT(vload, VEC)(0, src_row + first), 0, trg_row + first);
+				} else {
+					for(int i = max(first, 0); i < min(first + VEC, (int)size_x); ++i) trg_row[i] = src_row[i];
+				}
+			}
+		)";
+
+		constexpr const char* download_vec = R"(
+			#pragma OPENCL EXTENSION cl_khr_byte_addressable_store : enable
+			#pragma OPENCL EXTENSION cl_khr_fp64: enable
+
+			#define CAT_(a, b) a##b
+			#define CAT(a, b) CAT_(a, b)
+
+			__kernel void download_vec(
+				__global T *src, __global T *trg,
+				uint pos_x, uint pos_y, uint pos_z,
+				uint size_x, uint size_y, uint size_z,
+				uint stride, uint slice_stride)
+			{
+				uint slot = get_global_id(0);
+				uint line = get_global_id(1);
+				uint slice = get_global_id(2);
+				if(line >= size_y) return;
+				size_t row = pos_x + (size_t)(line + pos_y)*stride + (size_t)(slice + pos_z)*slice_stride;
+				int first = (int)(slot * VEC) - (int)(row % VEC);
+				if(first >= (int)size_x) return;
+				__global T *src_row = src + row;
+				__global T *trg_row = trg + ((size_t)slice*size_y + line)*size_x;
+				if(first >= 0 && first + VEC <= (int)size_x) {
+					CAT(vstore, VEC)(CAT(vload, VEC)(0, src_row + first), 0, trg_row + first);
+				} else {
+					for(int i = max(first, 0); i < min(first + VEC, (int)size_x); ++i) trg_row[i] = src_row[i];
+				}
+			}
+		)";
+
+		// Batch kernels: move several boxes of one buffer in a single launch. "boxes" is a table of 8 uints per box:
+		// pos_x, pos_y, pos_z, size_x, size_y, rows_per_group, first_group, staging_offset. Every box is covered by
+		// strips of rows_per_group rows within one slice, one work-group each, moved like in the tiled strip kernels.
+		// A work-group finds its box by scanning the first_group column, which is uniform across the group.
+
+		constexpr const char* upload_batch = R"(
+			#pragma OPENCL EXTENSION cl_khr_byte_addressable_store : enable
+			#pragma OPENCL EXTENSION cl_khr_fp64: enable
+
+			#ifndef V_T_DEFINED
+			#define V_T_DEFINED
+			typedef struct { T x[NUM]; } v_t;
+			#endif
+
+			__kernel void upload_batch(
+				__global v_t *src, __global v_t *trg,
+				__global const uint *boxes, uint num_boxes,
+				uint stride, uint slice_stride)
+			{
+				uint group = get_group_id(0);
+				uint b = 0;
+				while(b + 1 < num_boxes && group >= boxes[(b + 1)*8 + 6]) b++;
+				__global const uint *box = boxes + b*8;
+				uint size_x = box[3], size_y = box[4], rows_per_group = box[5];
+				uint groups_per_slice = (size_y + rows_per_group - 1) / rows_per_group;
+				uint slice = (group - box[6]) / groups_per_slice;
+				uint first_row = (group - box[6]) % groups_per_slice * rows_per_group;
+
+				uint lid = get_local_id(0);
+				uint lsize = get_local_size(0);
+				uint count = min(rows_per_group, size_y - first_row) * size_x;
+				__global v_t *src_tile = src + box[7] + ((size_t)slice*size_y + first_row)*size_x;
+				__global v_t *trg_tile = trg + box[0] + (size_t)(first_row + box[1])*stride + (size_t)(slice + box[2])*slice_stride;
+
+				uint step_row = lsize / size_x, step_col = lsize % size_x;
+				uint row = lid / size_x, col = lid % size_x;
+				for(uint i = lid; i < count; i += lsize) {
+					trg_tile[col + (size_t)row*stride] = src_tile[i];
+					row += step_row;
+					col += step_col;
+					if(col >= size_x) { col -= size_x; row++; }
+				}
+			}
+		)";
+
+		constexpr const char* download_batch = R"(
+			#pragma OPENCL EXTENSION cl_khr_byte_addressable_store : enable
+			#pragma OPENCL EXTENSION cl_khr_fp64: enable
+
+			#ifndef V_T_DEFINED
+			#define V_T_DEFINED
+			typedef struct { T x[NUM]; } v_t;
+			#endif
+
+			__kernel void download_batch(
+				__global v_t *src, __global v_t *trg,
+				__global const uint *boxes, uint num_boxes,
+				uint stride, uint slice_stride)
+			{
+				uint group = get_group_id(0);
+				uint b = 0;
+				while(b + 1 < num_boxes && group >= boxes[(b + 1)*8 + 6]) b++;
+				__global const uint *box = boxes + b*8;
+				uint size_x = box[3], size_y = box[4], rows_per_group = box[5];
+				uint groups_per_slice = (size_y + rows_per_group - 1) / rows_per_group;
+				uint slice = (group - box[6]) / groups_per_slice;
+				uint first_row = (group - box[6]) % groups_per_slice * rows_per_group;
+
+				uint lid = get_local_id(0);
+				uint lsize = get_local_size(0);
+				uint count = min(rows_per_group, size_y - first_row) * size_x;
+				__global v_t *src_tile = src + box[0] + (size_t)(first_row + box[1])*stride + (size_t)(slice + box[2])*slice_stride;
+				__global v_t *trg_tile = trg + box[7] + ((size_t)slice*size_y + first_row)*size_x;
+
+				uint step_row = lsize / size_x, step_col = lsize % size_x;
+				uint row = lid / size_x, col = lid % size_x;
+				for(uint i = lid; i < count; i += lsize) {
+					trg_tile[i] = src_tile[col + (size_t)row*stride];
+					row += step_row;
+					col += step_col;
+					if(col >= size_x) { col -= size_x; row++; }
+				}
+			}
+		)";
+
+		// Scatter / gather kernels: one work-item per element. The staging buffer holds the packed values followed by a
+		// table of uint linear indices into the device buffer, which starts index_offset uints into the staging buffer.
+
+		constexpr const char* scatter = R"(
+			#pragma OPENCL EXTENSION cl_khr_byte_addressable_store : enable
+			#pragma OPENCL EXTENSION cl_khr_fp64: enable
+
+			#ifndef V_T_DEFINED
+			#define V_T_DEFINED
+			typedef struct { T x[NUM]; } v_t;
+			#endif
+
+			__kernel void scatter(
+				__global v_t *src, __global v_t *trg,
+				uint index_offset, uint count)
+			{
+				uint i = get_global_id(0);
+				if(i >= count) return;
+				__global const uint *indices = (__global const uint *)src + index_offset;
+				trg[indices[i]] = src[i];
+			}
+		)";
+
+		constexpr const char* gather = R"(
+			#pragma OPENCL EXTENSION cl_khr_byte_addressable_store : enable
+			#pragma OPENCL EXTENSION cl_khr_fp64: enable
+
+			#ifndef V_T_DEFINED
+			#define V_T_DEFINED
+			typedef struct { T x[NUM]; } v_t;
+			#endif
+
+			__kernel void gather(
+				__global v_t *src, __global v_t *trg,
+				uint index_offset, uint count)
+			{
+				uint i = get_global_id(0);
+				if(i >= count) return;
+				__global const uint *indices = (__global const uint *)trg + index_offset;
+				trg[i] = src[indices[i]];
+			}
+		)";
+
+		// Copy kernel: moves a box between two device buffers of different extents (or two boxes of one buffer), with
+		// positions and strides given for each side. A 2D box is a single slice.
+
+		constexpr const char* copy_3D = R"(
+			#pragma OPENCL EXTENSION cl_khr_byte_addressable_store : enable
+			#pragma OPENCL EXTENSION cl_khr_fp64: enable
+
+			#ifndef V_T_DEFINED
+			#define V_T_DEFINED
+			typedef struct { T x[NUM]; } v_t;
+			#endif
+
+			__kernel void copy_3D(
+				__global v_t *src, __global v_t *trg,
+				uint src_x, uint src_y, uint src_z,
+				uint trg_x, uint trg_y, uint trg_z,
+				uint size_x, uint size_y, uint size_z,
+				uint src_stride, uint src_slice_stride,
+				uint trg_stride, uint trg_slice_stride)
+			{
+				uint col = get_global_id(0);
+				uint line = get_global_id(1);
+				uint slice = get_global_id(2);
+				if(col >= size_x || line >= size_y) return;
+				trg[col + trg_x + (size_t)(line + trg_y)*trg_stride + (size_t)(slice + trg_z)*trg_slice_stride] =
+					src[col + src_x + (size_t)(line + src_y)*src_stride + (size_t)(slice + src_z)*src_slice_stride];
 			}
 		)";
 	}
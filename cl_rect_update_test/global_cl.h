@@ -17,8 +17,14 @@ class GlobalCl {
 		}
 
 
-		cl_device_id _dev = cluInitDevice(platform, &_context, &_queue);
-		cl_rul::init_rect_update_lib(_context, _dev);
+		_dev = cluInitDevice(platform, &_context, &_queue);
+		cl_rul::init_rect_update_lib(_context, _dev, true);
+
+		// wait for all kernels, so the Kernel method is never served by its ClRect fallback
+		cl_rul::detail::cl_rul_context& lib = cl_rul::detail::g_instances.get(_context, _dev);
+		#define BUF_TYPE(_htype, _dtype) cl_rul::detail::build_all_transfer_kernels<_htype>(lib);
+		#include "../cl_rect_update_lib/buffer_types.inc"
+		#undef BUF_TYPE
 	}
 
 	static std::unique_ptr<GlobalCl> state;
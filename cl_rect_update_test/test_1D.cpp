@@ -49,6 +49,9 @@ TEST_CASE("1D float buffers", "[1D]") {
 	SECTION("partial upload [automatic]") {
 		partial_1D_float_upload_test<cl_rul::Automatic, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
 	}
+	SECTION("partial upload [runtime]") {
+		partial_1D_float_upload_test<cl_rul::Runtime, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
+	}
 
 	SECTION("partial download [individual]") {
 		partial_1D_float_download_test<cl_rul::Individual, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
@@ -59,6 +62,9 @@ TEST_CASE("1D float buffers", "[1D]") {
 	SECTION("partial download [automatic]") {
 		partial_1D_float_download_test<cl_rul::Automatic, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
 	}
+	SECTION("partial download [runtime]") {
+		partial_1D_float_download_test<cl_rul::Runtime, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
+	}
 }
 
 /// /////////////////////////////////////////////////////////////////////// Char4
@@ -111,6 +117,9 @@ TEST_CASE("1D char4 buffers", "[1D]") {
 	SECTION("partial upload [automatic]") {
 		partial_1D_char4_upload_test<cl_rul::Automatic, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
 	}
+	SECTION("partial upload [runtime]") {
+		partial_1D_char4_upload_test<cl_rul::Runtime, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
+	}
 
 	SECTION("partial download [individual]") {
 		partial_1D_char4_download_test<cl_rul::Individual, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
@@ -121,4 +130,7 @@ TEST_CASE("1D char4 buffers", "[1D]") {
 	SECTION("partial download [automatic]") {
 		partial_1D_char4_download_test<cl_rul::Automatic, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
 	}
+	SECTION("partial download [runtime]") {
+		partial_1D_char4_download_test<cl_rul::Runtime, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
+	}
 }
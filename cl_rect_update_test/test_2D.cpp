@@ -6,6 +6,7 @@
 #include <iostream>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 /// /////////////////////////////////////////////////////////////////////// Float
 
@@ -119,9 +120,15 @@ TEST_CASE("2D float buffers", "[2D]") {
 	SECTION("partial upload [kernel]") {
 		partial_2D_float_upload_test<cl_rul::Kernel, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
 	}
+	SECTION("partial upload [mapped]") {
+		partial_2D_float_upload_test<cl_rul::Mapped, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
+	}
 	SECTION("partial upload [automatic]") {
 		partial_2D_float_upload_test<cl_rul::Automatic, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
 	}
+	SECTION("partial upload [runtime]") {
+		partial_2D_float_upload_test<cl_rul::Runtime, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
+	}
 
 	SECTION("column upload [individual]") {
 		float_column_upload_test<cl_rul::Individual, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
@@ -132,9 +139,15 @@ TEST_CASE("2D float buffers", "[2D]") {
 	SECTION("column upload [kernel]") {
 		float_column_upload_test<cl_rul::Kernel, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
 	}
+	SECTION("column upload [mapped]") {
+		float_column_upload_test<cl_rul::Mapped, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
+	}
 	SECTION("column upload [automatic]") {
 		float_column_upload_test<cl_rul::Automatic, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
 	}
+	SECTION("column upload [runtime]") {
+		float_column_upload_test<cl_rul::Runtime, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
+	}
 
 	SECTION("single cell upload [individual]") {
 		single_cell_upload_test<cl_rul::Individual, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
@@ -145,9 +158,15 @@ TEST_CASE("2D float buffers", "[2D]") {
 	SECTION("single cell upload [kernel]") {
 		single_cell_upload_test<cl_rul::Kernel, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
 	}
+	SECTION("single cell upload [mapped]") {
+		single_cell_upload_test<cl_rul::Mapped, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
+	}
 	SECTION("single cell upload [automatic]") {
 		single_cell_upload_test<cl_rul::Automatic, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
 	}
+	SECTION("single cell upload [runtime]") {
+		single_cell_upload_test<cl_rul::Runtime, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
+	}
 
 	SECTION("partial download [individual]") {
 		partial_2D_float_download_test<cl_rul::Individual, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
@@ -158,9 +177,15 @@ TEST_CASE("2D float buffers", "[2D]") {
 	SECTION("partial download [kernel]") {
 		partial_2D_float_download_test<cl_rul::Kernel, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
 	}
+	SECTION("partial download [mapped]") {
+		partial_2D_float_download_test<cl_rul::Mapped, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
+	}
 	SECTION("partial download [automatic]") {
 		partial_2D_float_download_test<cl_rul::Automatic, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
 	}
+	SECTION("partial download [runtime]") {
+		partial_2D_float_download_test<cl_rul::Runtime, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
+	}
 
 	SECTION("column download [individual]") {
 		float_column_download_test<cl_rul::Individual, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
@@ -171,9 +196,15 @@ TEST_CASE("2D float buffers", "[2D]") {
 	SECTION("column download [kernel]") {
 		float_column_download_test<cl_rul::Kernel, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
 	}
+	SECTION("column download [mapped]") {
+		float_column_download_test<cl_rul::Mapped, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
+	}
 	SECTION("column download [automatic]") {
 		float_column_download_test<cl_rul::Automatic, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
 	}
+	SECTION("column download [runtime]") {
+		float_column_download_test<cl_rul::Runtime, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
+	}
 
 	SECTION("single cell download [individual]") {
 		single_cell_download_test<cl_rul::Individual, TEST_L>(GlobalCl::queue(), device_buffer);
@@ -184,9 +215,15 @@ TEST_CASE("2D float buffers", "[2D]") {
 	SECTION("single cell download [kernel]") {
 		single_cell_download_test<cl_rul::Kernel, TEST_L>(GlobalCl::queue(), device_buffer);
 	}
+	SECTION("single cell download [mapped]") {
+		single_cell_download_test<cl_rul::Mapped, TEST_L>(GlobalCl::queue(), device_buffer);
+	}
 	SECTION("single_cell download [automatic]") {
 		single_cell_download_test<cl_rul::Automatic, TEST_L>(GlobalCl::queue(), device_buffer);
 	}
+	SECTION("single_cell download [runtime]") {
+		single_cell_download_test<cl_rul::Runtime, TEST_L>(GlobalCl::queue(), device_buffer);
+	}
 }
 
 /// /////////////////////////////////////////////////////////////////////// Custom type
@@ -277,6 +314,9 @@ TEST_CASE("2D custom type buffers", "[2D]") {
 	SECTION("partial upload [automatic]") {
 		partial_2D_custom_upload_test<cl_rul::Automatic, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
 	}
+	SECTION("partial upload [runtime]") {
+		partial_2D_custom_upload_test<cl_rul::Runtime, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
+	}
 
 	SECTION("partial download [individual]") {
 		partial_2D_custom_download_test<cl_rul::Individual, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
@@ -290,4 +330,140 @@ TEST_CASE("2D custom type buffers", "[2D]") {
 	SECTION("partial download [automatic]") {
 		partial_2D_custom_download_test<cl_rul::Automatic, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
 	}
+	SECTION("partial download [runtime]") {
+		partial_2D_custom_download_test<cl_rul::Runtime, TEST_L>(GlobalCl::queue(), device_buffer, host_buffer2);
+	}
+}
+
+TEST_CASE("kernels are shared by types of the same size", "[2D]") {
+	cl_rul::detail::cl_rul_context& lib = cl_rul::detail::instance_of(GlobalCl::queue());
+	REQUIRE(&lib.transfer_kernels<cl_float>() == &lib.transfer_kernels<cl_int>());
+	REQUIRE(&lib.transfer_kernels<cl_float>() == &lib.transfer_kernels<cl_uchar4>());
+	REQUIRE(&lib.transfer_kernels<cl_double>() == &lib.transfer_kernels<cl_long>());
+	REQUIRE(&lib.transfer_kernels<CustomType>() != &lib.transfer_kernels<cl_float>());
+
+	const cl_kernel kernel = cl_rul::detail::get_transfer_kernel<cl_float>(lib, cl_rul::detail::kernel_id::Upload2D);
+	REQUIRE(cl_rul::detail::get_transfer_kernel<cl_uint>(lib, cl_rul::detail::kernel_id::Upload2D) == kernel);
+}
+
+/// /////////////////////////////////////////////////////////////////////// Wide boxes (padded NDRange)
+
+template<typename Method, typename T = cl_float>
+void wide_box_roundtrip_test(cl_command_queue queue, cl_mem device_buffer, const cl_rul::Extent& buffer_size, const cl_rul::Box& box) {
+	std::vector<T> to_upload(box.size());
+	for(size_t i = 0; i < to_upload.size(); ++i) to_upload[i] = (T)(1000 + 3 * i);
+
+	cl_rul::upload_rect<T, Method>(queue, device_buffer, buffer_size, box, to_upload.data());
+
+	std::vector<T> full(buffer_size.size());
+	REQUIRE(clEnqueueReadBuffer(queue, device_buffer, CL_TRUE, 0, full.size() * sizeof(T), full.data(), 0, nullptr, nullptr) == CL_SUCCESS);
+	for(size_t y = 0; y < buffer_size.ys; ++y) {
+		for(size_t x = 0; x < buffer_size.xs; ++x) {
+			const bool inside = x >= box.origin.x && x < box.origin.x + box.extent.xs && y >= box.origin.y && y < box.origin.y + box.extent.ys;
+			const T expected = inside ? to_upload[(y - box.origin.y) * box.extent.xs + x - box.origin.x] : (T)(y * buffer_size.xs + x);
+			REQUIRE(full[y * buffer_size.xs + x] == expected);
+		}
+	}
+
+	std::vector<T> downloaded(box.size());
+	cl_rul::download_rect<T, Method>(queue, device_buffer, buffer_size, box, downloaded.data());
+	clFinish(queue);
+	check_1D(to_upload.data(), downloaded.data(), box.size());
+}
+
+TEST_CASE("2D wide float boxes", "[2D]") {
+	const cl_rul::Extent buffer_size = { 150u, 7u, 1u };
+
+	std::vector<cl_float> host_buffer(buffer_size.size());
+	for(size_t i = 0; i < host_buffer.size(); ++i) host_buffer[i] = (cl_float)i;
+
+	cl_int errcode;
+	cl_mem device_buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, host_buffer.size() * sizeof(cl_float), host_buffer.data(), &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	const cl_rul::Box wide_box = { { 3u,1u,0u },{ 131u,5u,1u } };
+	const cl_rul::Box odd_box = { { 1u,2u,0u },{ 37u,3u,1u } };
+
+	SECTION("wide box [kernel]") {
+		wide_box_roundtrip_test<cl_rul::Kernel>(GlobalCl::queue(), device_buffer, buffer_size, wide_box);
+	}
+	SECTION("odd box [kernel]") {
+		wide_box_roundtrip_test<cl_rul::Kernel>(GlobalCl::queue(), device_buffer, buffer_size, odd_box);
+	}
+	SECTION("wide box [automatic]") {
+		wide_box_roundtrip_test<cl_rul::Automatic>(GlobalCl::queue(), device_buffer, buffer_size, wide_box);
+	}
+
+	clReleaseMemObject(device_buffer);
+}
+
+/// /////////////////////////////////////////////////////////////////////// Narrow boxes (tiled strip kernels)
+
+TEST_CASE("2D narrow float boxes", "[2D]") {
+	const cl_rul::Extent buffer_size = { 10u, 300u, 1u };
+
+	std::vector<cl_float> host_buffer(buffer_size.size());
+	for(size_t i = 0; i < host_buffer.size(); ++i) host_buffer[i] = (cl_float)i;
+
+	cl_int errcode;
+	cl_mem device_buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, host_buffer.size() * sizeof(cl_float), host_buffer.data(), &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	// several work-groups, the last one partially filled
+	const cl_rul::Box strip = { { 2u,5u,0u },{ 3u,290u,1u } };
+	const cl_rul::Box column = { { 9u,0u,0u },{ 1u,300u,1u } };
+
+	SECTION("strip [kernel]") {
+		wide_box_roundtrip_test<cl_rul::Kernel>(GlobalCl::queue(), device_buffer, buffer_size, strip);
+	}
+	SECTION("column [kernel]") {
+		wide_box_roundtrip_test<cl_rul::Kernel>(GlobalCl::queue(), device_buffer, buffer_size, column);
+	}
+	SECTION("strip [automatic]") {
+		wide_box_roundtrip_test<cl_rul::Automatic>(GlobalCl::queue(), device_buffer, buffer_size, strip);
+	}
+
+	clReleaseMemObject(device_buffer);
+}
+
+/// /////////////////////////////////////////////////////////////////////// Small element types (vectorized kernels)
+
+template<typename T>
+cl_mem create_indexed_buffer(const cl_rul::Extent& buffer_size) {
+	std::vector<T> host_buffer(buffer_size.size());
+	for(size_t i = 0; i < host_buffer.size(); ++i) host_buffer[i] = (T)i;
+
+	cl_int errcode;
+	cl_mem device_buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, host_buffer.size() * sizeof(T), host_buffer.data(), &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+	return device_buffer;
+}
+
+TEST_CASE("2D small element boxes", "[2D]") {
+	const cl_rul::Extent buffer_size = { 203u, 9u, 1u };
+
+	// unaligned start and end on every row, as the row stride is odd
+	const cl_rul::Box box = { { 3u,1u,0u },{ 187u,7u,1u } };
+
+	SECTION("uchar [kernel]") {
+		cl_mem device_buffer = create_indexed_buffer<cl_uchar>(buffer_size);
+		wide_box_roundtrip_test<cl_rul::Kernel, cl_uchar>(GlobalCl::queue(), device_buffer, buffer_size, box);
+		clReleaseMemObject(device_buffer);
+	}
+	SECTION("short [kernel]") {
+		cl_mem device_buffer = create_indexed_buffer<cl_short>(buffer_size);
+		wide_box_roundtrip_test<cl_rul::Kernel, cl_short>(GlobalCl::queue(), device_buffer, buffer_size, box);
+		clReleaseMemObject(device_buffer);
+	}
+	SECTION("ushort short rows [kernel]") {
+		const cl_rul::Box short_rows = { { 5u,2u,0u },{ 61u,6u,1u } };
+		cl_mem device_buffer = create_indexed_buffer<cl_ushort>(buffer_size);
+		wide_box_roundtrip_test<cl_rul::Kernel, cl_ushort>(GlobalCl::queue(), device_buffer, buffer_size, short_rows);
+		clReleaseMemObject(device_buffer);
+	}
+	SECTION("uchar [automatic]") {
+		cl_mem device_buffer = create_indexed_buffer<cl_uchar>(buffer_size);
+		wide_box_roundtrip_test<cl_rul::Automatic, cl_uchar>(GlobalCl::queue(), device_buffer, buffer_size, box);
+		clReleaseMemObject(device_buffer);
+	}
 }
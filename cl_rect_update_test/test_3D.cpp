@@ -0,0 +1,219 @@
+#include "../ext/catch.hpp"
+
+#include "global_cl.h"
+#include "test_utils.h"
+
+#include <vector>
+
+/// /////////////////////////////////////////////////////////////////////// Float
+
+namespace {
+	constexpr size_t TEST_L = 4;
+
+	inline cl_float initial_value(size_t x, size_t y, size_t z) {
+		return (cl_float)(x + 10 * y + 100 * z);
+	}
+
+	// fills "expected" with the initial buffer contents, overwritten by "values" inside "box"
+	inline void expected_after_upload(const cl_rul::Box& box, const cl_float* values, cl_float* expected) {
+		size_t i = 0;
+		for(size_t z = 0; z < TEST_L; ++z) {
+			for(size_t y = 0; y < TEST_L; ++y) {
+				for(size_t x = 0; x < TEST_L; ++x) {
+					expected[x + TEST_L * (y + TEST_L * z)] = initial_value(x, y, z);
+				}
+			}
+		}
+		for(size_t z = box.origin.z; z < box.origin.z + box.extent.zs; ++z) {
+			for(size_t y = box.origin.y; y < box.origin.y + box.extent.ys; ++y) {
+				for(size_t x = box.origin.x; x < box.origin.x + box.extent.xs; ++x) {
+					expected[x + TEST_L * (y + TEST_L * z)] = values[i++];
+				}
+			}
+		}
+	}
+
+	inline std::vector<cl_float> expected_download(const cl_rul::Box& box) {
+		std::vector<cl_float> ret;
+		for(size_t z = box.origin.z; z < box.origin.z + box.extent.zs; ++z) {
+			for(size_t y = box.origin.y; y < box.origin.y + box.extent.ys; ++y) {
+				for(size_t x = box.origin.x; x < box.origin.x + box.extent.xs; ++x) {
+					ret.push_back(initial_value(x, y, z));
+				}
+			}
+		}
+		return ret;
+	}
+}
+
+template<typename Method>
+void box_3D_float_upload_test(cl_command_queue queue, cl_mem device_buffer, const cl_rul::Box& box) {
+	std::vector<cl_float> to_upload(box.size());
+	for(size_t i = 0; i < to_upload.size(); ++i) to_upload[i] = 1000.f + i;
+
+	cl_rul::upload_rect<cl_float, Method>(queue, device_buffer, { TEST_L,TEST_L,TEST_L }, box, to_upload.data());
+
+	cl_float result[TEST_L * TEST_L * TEST_L];
+	REQUIRE(clEnqueueReadBuffer(queue, device_buffer, CL_TRUE, 0, sizeof(result), result, 0, nullptr, nullptr) == CL_SUCCESS);
+
+	cl_float expected[TEST_L * TEST_L * TEST_L];
+	expected_after_upload(box, to_upload.data(), expected);
+	check_1D(expected, result, TEST_L * TEST_L * TEST_L);
+}
+
+template<typename Method>
+void box_3D_float_download_test(cl_command_queue queue, cl_mem device_buffer, const cl_rul::Box& box) {
+	std::vector<cl_float> result(box.size(), -1.f);
+
+	cl_rul::download_rect<cl_float, Method>(queue, device_buffer, { TEST_L,TEST_L,TEST_L }, box, result.data());
+	clFinish(queue);
+
+	std::vector<cl_float> expected = expected_download(box);
+	check_1D(expected.data(), result.data(), box.size());
+}
+
+// the box is taken from / written to a larger host grid, at an offset
+const cl_rul::Extent host_grid_size = { TEST_L + 3, TEST_L + 1, TEST_L + 2 };
+const cl_rul::Point host_origin = { 2u,1u,1u };
+
+template<typename Method>
+void box_3D_float_pitched_upload_test(cl_command_queue queue, cl_mem device_buffer, const cl_rul::Box& box) {
+	std::vector<cl_float> host_grid(host_grid_size.size(), -1.f);
+	std::vector<cl_float> to_upload;
+	for(size_t z = 0; z < box.extent.zs; ++z) {
+		for(size_t y = 0; y < box.extent.ys; ++y) {
+			for(size_t x = 0; x < box.extent.xs; ++x) {
+				to_upload.push_back(1000.f + to_upload.size());
+				host_grid[host_grid_size.row_offset(host_origin.y + y, host_origin.z + z) + host_origin.x + x] = to_upload.back();
+			}
+		}
+	}
+
+	cl_rul::upload_rect<cl_float, Method>(queue, device_buffer, { TEST_L,TEST_L,TEST_L }, box, host_grid.data(), host_grid_size, host_origin);
+
+	cl_float result[TEST_L * TEST_L * TEST_L];
+	REQUIRE(clEnqueueReadBuffer(queue, device_buffer, CL_TRUE, 0, sizeof(result), result, 0, nullptr, nullptr) == CL_SUCCESS);
+
+	cl_float expected[TEST_L * TEST_L * TEST_L];
+	expected_after_upload(box, to_upload.data(), expected);
+	check_1D(expected, result, TEST_L * TEST_L * TEST_L);
+}
+
+template<typename Method>
+void box_3D_float_pitched_download_test(cl_command_queue queue, cl_mem device_buffer, const cl_rul::Box& box) {
+	std::vector<cl_float> host_grid(host_grid_size.size(), -1.f);
+
+	cl_rul::download_rect<cl_float, Method>(queue, device_buffer, { TEST_L,TEST_L,TEST_L }, box, host_grid.data(), host_grid_size, host_origin);
+	clFinish(queue);
+
+	std::vector<cl_float> expected(host_grid_size.size(), -1.f);
+	std::vector<cl_float> values = expected_download(box);
+	size_t i = 0;
+	for(size_t z = 0; z < box.extent.zs; ++z) {
+		for(size_t y = 0; y < box.extent.ys; ++y) {
+			for(size_t x = 0; x < box.extent.xs; ++x) {
+				expected[host_grid_size.row_offset(host_origin.y + y, host_origin.z + z) + host_origin.x + x] = values[i++];
+			}
+		}
+	}
+	check_1D(expected.data(), host_grid.data(), expected.size());
+}
+
+// upload and download without events, completed by finishing the queue
+template<typename Method>
+void box_3D_float_no_event_test(cl_command_queue queue, cl_mem device_buffer, const cl_rul::Box& box) {
+	std::vector<cl_float> to_upload(box.size());
+	for(size_t i = 0; i < to_upload.size(); ++i) to_upload[i] = 2000.f + i;
+	std::vector<cl_float> result(box.size(), -1.f);
+
+	cl_rul::upload_rect<cl_float, Method>(cl_rul::no_event, queue, device_buffer, { TEST_L,TEST_L,TEST_L }, box, to_upload.data());
+	clFinish(queue);
+	cl_rul::download_rect<cl_float, Method>(cl_rul::no_event, queue, device_buffer, { TEST_L,TEST_L,TEST_L }, box, result.data());
+	clFinish(queue);
+
+	check_1D(to_upload.data(), result.data(), box.size());
+}
+
+template<typename Method>
+void box_3D_float_tests(cl_mem device_buffer) {
+	const cl_rul::Box inner_box = { { 1u,1u,1u },{ 2u,2u,2u } };
+	const cl_rul::Box x_face = { { 3u,0u,0u },{ 1u,TEST_L,TEST_L } };
+	const cl_rul::Box y_face = { { 0u,2u,0u },{ TEST_L,1u,TEST_L } };
+	const cl_rul::Box z_column = { { 2u,1u,0u },{ 1u,1u,TEST_L } };
+	const cl_rul::Box upper_slice = { { 1u,0u,2u },{ 3u,2u,1u } };
+	const cl_rul::Box full_slices = { { 0u,0u,1u },{ TEST_L,TEST_L,2u } };
+
+	SECTION("inner box upload") { box_3D_float_upload_test<Method>(GlobalCl::queue(), device_buffer, inner_box); }
+	SECTION("x face upload") { box_3D_float_upload_test<Method>(GlobalCl::queue(), device_buffer, x_face); }
+	SECTION("y face upload") { box_3D_float_upload_test<Method>(GlobalCl::queue(), device_buffer, y_face); }
+	SECTION("z column upload") { box_3D_float_upload_test<Method>(GlobalCl::queue(), device_buffer, z_column); }
+	SECTION("upper slice upload") { box_3D_float_upload_test<Method>(GlobalCl::queue(), device_buffer, upper_slice); }
+
+	SECTION("inner box download") { box_3D_float_download_test<Method>(GlobalCl::queue(), device_buffer, inner_box); }
+	SECTION("x face download") { box_3D_float_download_test<Method>(GlobalCl::queue(), device_buffer, x_face); }
+	SECTION("y face download") { box_3D_float_download_test<Method>(GlobalCl::queue(), device_buffer, y_face); }
+	SECTION("z column download") { box_3D_float_download_test<Method>(GlobalCl::queue(), device_buffer, z_column); }
+	SECTION("upper slice download") { box_3D_float_download_test<Method>(GlobalCl::queue(), device_buffer, upper_slice); }
+
+	SECTION("inner box pitched upload") { box_3D_float_pitched_upload_test<Method>(GlobalCl::queue(), device_buffer, inner_box); }
+	SECTION("y face pitched upload") { box_3D_float_pitched_upload_test<Method>(GlobalCl::queue(), device_buffer, y_face); }
+	SECTION("full slices pitched upload") { box_3D_float_pitched_upload_test<Method>(GlobalCl::queue(), device_buffer, full_slices); }
+
+	SECTION("inner box pitched download") { box_3D_float_pitched_download_test<Method>(GlobalCl::queue(), device_buffer, inner_box); }
+	SECTION("y face pitched download") { box_3D_float_pitched_download_test<Method>(GlobalCl::queue(), device_buffer, y_face); }
+	SECTION("full slices pitched download") { box_3D_float_pitched_download_test<Method>(GlobalCl::queue(), device_buffer, full_slices); }
+
+	SECTION("inner box without events") { box_3D_float_no_event_test<Method>(GlobalCl::queue(), device_buffer, inner_box); }
+	SECTION("full slices without events") { box_3D_float_no_event_test<Method>(GlobalCl::queue(), device_buffer, full_slices); }
+}
+
+TEST_CASE("3D float buffers", "[3D]") {
+
+	cl_float host_buffer[TEST_L][TEST_L][TEST_L];
+
+	for(size_t z = 0; z < TEST_L; ++z) {
+		for(size_t y = 0; y < TEST_L; ++y) {
+			for(size_t x = 0; x < TEST_L; ++x) {
+				host_buffer[z][y][x] = initial_value(x, y, z);
+			}
+		}
+	}
+
+	cl_int errcode;
+	cl_mem device_buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(host_buffer), host_buffer, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	SECTION("[individual]") {
+		box_3D_float_tests<cl_rul::Individual>(device_buffer);
+	}
+	SECTION("[rect]") {
+		box_3D_float_tests<cl_rul::ClRect>(device_buffer);
+	}
+	SECTION("[kernel]") {
+		box_3D_float_tests<cl_rul::Kernel>(device_buffer);
+	}
+	SECTION("[mapped]") {
+		box_3D_float_tests<cl_rul::Mapped>(device_buffer);
+	}
+	SECTION("[pipelined]") {
+		// chunks of one slice or one row, with the host transfers on a separate queue
+		cl_device_id device;
+		REQUIRE(clGetCommandQueueInfo(GlobalCl::queue(), CL_QUEUE_DEVICE, sizeof(device), &device, nullptr) == CL_SUCCESS);
+		cl_command_queue copy_queue = clCreateCommandQueue(GlobalCl::context(), device, 0, &errcode);
+		REQUIRE(errcode == CL_SUCCESS);
+		{
+			pipelining_scope pipelining(1, TEST_L * sizeof(cl_float), copy_queue);
+			box_3D_float_tests<cl_rul::Kernel>(device_buffer);
+		}
+		clFinish(copy_queue);
+		clReleaseCommandQueue(copy_queue);
+	}
+	SECTION("[automatic]") {
+		box_3D_float_tests<cl_rul::Automatic>(device_buffer);
+	}
+	SECTION("[runtime]") {
+		box_3D_float_tests<cl_rul::Runtime>(device_buffer);
+	}
+
+	clReleaseMemObject(device_buffer);
+}
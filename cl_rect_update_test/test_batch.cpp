@@ -0,0 +1,89 @@
+#include "../ext/catch.hpp"
+
+#include "global_cl.h"
+#include "test_utils.h"
+
+#include <vector>
+
+namespace {
+	cl_float batch_value(size_t x, size_t y, size_t z) {
+		return (cl_float)(x + 100 * y + 10000 * z);
+	}
+}
+
+TEST_CASE("batched halo transfers", "[batch][3D]") {
+	const cl_rul::Extent buffer_size = { 70u, 12u, 9u };
+	// the six faces of the inner block, a wide face, narrow columns and a box spanning all slices
+	const cl_rul::Box halos[] = {
+		{ { 1u,1u,0u },{ 68u,10u,1u } },
+		{ { 1u,1u,8u },{ 68u,10u,1u } },
+		{ { 1u,0u,1u },{ 68u,1u,7u } },
+		{ { 1u,11u,1u },{ 68u,1u,7u } },
+		{ { 0u,1u,1u },{ 1u,10u,7u } },
+		{ { 69u,1u,1u },{ 1u,10u,7u } },
+		{ { 5u,5u,5u },{ 0u,3u,3u } }, // empty
+	};
+	const size_t num_halos = sizeof(halos) / sizeof(halos[0]);
+
+	std::vector<cl_float> host_buffer(buffer_size.size());
+	for(size_t z = 0; z < buffer_size.zs; ++z) {
+		for(size_t y = 0; y < buffer_size.ys; ++y) {
+			for(size_t x = 0; x < buffer_size.xs; ++x) {
+				host_buffer[buffer_size.row_offset(y, z) + x] = batch_value(x, y, z);
+			}
+		}
+	}
+
+	cl_int errcode;
+	cl_mem device_buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, host_buffer.size() * sizeof(cl_float), host_buffer.data(), &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	size_t total = 0;
+	for(const cl_rul::Box& b : halos) total += b.size();
+
+	SECTION("download") {
+		std::vector<cl_float> downloaded(total);
+		cl_event ev = cl_rul::download_rects(GlobalCl::queue(), device_buffer, buffer_size, halos, num_halos, downloaded.data());
+		REQUIRE(clWaitForEvents(1, &ev) == CL_SUCCESS);
+		clReleaseEvent(ev);
+
+		size_t i = 0;
+		for(const cl_rul::Box& b : halos) {
+			for(size_t z = b.origin.z; z < b.origin.z + b.extent.zs; ++z) {
+				for(size_t y = b.origin.y; y < b.origin.y + b.extent.ys; ++y) {
+					for(size_t x = b.origin.x; x < b.origin.x + b.extent.xs; ++x) {
+						REQUIRE(downloaded[i++] == batch_value(x, y, z));
+					}
+				}
+			}
+		}
+	}
+
+	SECTION("upload") {
+		std::vector<cl_float> to_upload(total);
+		for(size_t i = 0; i < total; ++i) to_upload[i] = -(cl_float)(i + 1);
+		cl_event ev = cl_rul::upload_rects(GlobalCl::queue(), device_buffer, buffer_size, halos, num_halos, to_upload.data());
+		clReleaseEvent(ev);
+
+		size_t i = 0;
+		for(const cl_rul::Box& b : halos) {
+			for(size_t z = b.origin.z; z < b.origin.z + b.extent.zs; ++z) {
+				for(size_t y = b.origin.y; y < b.origin.y + b.extent.ys; ++y) {
+					for(size_t x = b.origin.x; x < b.origin.x + b.extent.xs; ++x) {
+						host_buffer[buffer_size.row_offset(y, z) + x] = to_upload[i++];
+					}
+				}
+			}
+		}
+
+		std::vector<cl_float> result(host_buffer.size());
+		REQUIRE(clEnqueueReadBuffer(GlobalCl::queue(), device_buffer, CL_TRUE, 0, result.size() * sizeof(cl_float), result.data(), 0, nullptr, nullptr) == CL_SUCCESS);
+		check_1D(host_buffer.data(), result.data(), result.size());
+	}
+
+	SECTION("nothing to transfer") {
+		REQUIRE(cl_rul::upload_rects<cl_float>(GlobalCl::queue(), device_buffer, buffer_size, halos + 6, 1, nullptr) == nullptr);
+	}
+
+	clReleaseMemObject(device_buffer);
+}
@@ -0,0 +1,128 @@
+#include "../ext/catch.hpp"
+
+#include "global_cl.h"
+#include "test_utils.h"
+
+#include <vector>
+
+namespace {
+	const cl_rul::Extent source_size = { 12u, 7u, 5u };
+	const cl_rul::Extent target_size = { 9u, 10u, 4u };
+
+	cl_float source_value(size_t x, size_t y, size_t z) {
+		return (cl_float)(x + 100 * y + 10000 * z);
+	}
+
+	// copies "box" of a source buffer filled with source_value to "target_origin" of a target buffer filled with -1,
+	// and checks the whole target buffer
+	template<typename Method>
+	void copy_test(const cl_rul::Box& box, const cl_rul::Point& target_origin, bool want_event = true) {
+		std::vector<cl_float> source(source_size.size());
+		for(size_t z = 0; z < source_size.zs; ++z) {
+			for(size_t y = 0; y < source_size.ys; ++y) {
+				for(size_t x = 0; x < source_size.xs; ++x) {
+					source[source_size.row_offset(y, z) + x] = source_value(x, y, z);
+				}
+			}
+		}
+		std::vector<cl_float> expected(target_size.size(), -1.f);
+
+		cl_int errcode;
+		cl_mem source_buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, source.size() * sizeof(cl_float), source.data(), &errcode);
+		REQUIRE(errcode == CL_SUCCESS);
+		cl_mem target_buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, expected.size() * sizeof(cl_float), expected.data(), &errcode);
+		REQUIRE(errcode == CL_SUCCESS);
+
+		if(want_event) {
+			cl_event ev = cl_rul::copy_rect<cl_float, Method>(GlobalCl::queue(), source_buffer, source_size, box, target_buffer, target_size, target_origin);
+			REQUIRE(ev != nullptr);
+			REQUIRE(clWaitForEvents(1, &ev) == CL_SUCCESS);
+			clReleaseEvent(ev);
+		} else {
+			cl_rul::copy_rect<cl_float, Method>(cl_rul::no_event, GlobalCl::queue(), source_buffer, source_size, box, target_buffer, target_size, target_origin);
+		}
+
+		for(size_t z = 0; z < box.extent.zs; ++z) {
+			for(size_t y = 0; y < box.extent.ys; ++y) {
+				for(size_t x = 0; x < box.extent.xs; ++x) {
+					expected[target_size.row_offset(target_origin.y + y, target_origin.z + z) + target_origin.x + x] = source_value(box.origin.x + x, box.origin.y + y, box.origin.z + z);
+				}
+			}
+		}
+		std::vector<cl_float> result(target_size.size());
+		REQUIRE(clEnqueueReadBuffer(GlobalCl::queue(), target_buffer, CL_TRUE, 0, result.size() * sizeof(cl_float), result.data(), 0, nullptr, nullptr) == CL_SUCCESS);
+		check_1D(expected.data(), result.data(), result.size());
+
+		clReleaseMemObject(target_buffer);
+		clReleaseMemObject(source_buffer);
+	}
+
+	template<typename Method>
+	void copy_tests() {
+		SECTION("2D box") {
+			copy_test<Method>({ { 2u,1u,3u },{ 6u,5u,1u } }, { 1u,4u,2u });
+		}
+		SECTION("3D box") {
+			copy_test<Method>({ { 3u,2u,1u },{ 5u,4u,3u } }, { 2u,5u,0u });
+		}
+		SECTION("column") {
+			copy_test<Method>({ { 11u,0u,0u },{ 1u,7u,4u } }, { 0u,3u,0u });
+		}
+		SECTION("row") {
+			copy_test<Method>({ { 1u,6u,4u },{ 8u,1u,1u } }, { 0u,9u,3u });
+		}
+		SECTION("without event") {
+			copy_test<Method>({ { 3u,2u,1u },{ 5u,4u,3u } }, { 2u,5u,0u }, false);
+			clFinish(GlobalCl::queue());
+		}
+	}
+}
+
+TEST_CASE("copy boxes between buffers - Individual", "[copy]") {
+	copy_tests<cl_rul::Individual>();
+}
+
+TEST_CASE("copy boxes between buffers - ClRect", "[copy]") {
+	copy_tests<cl_rul::ClRect>();
+}
+
+TEST_CASE("copy boxes between buffers - Kernel", "[copy]") {
+	// the kernel rather than the ClRect fallback used while it compiles
+	cl_rul::detail::build_all_transfer_kernels<cl_float>(cl_rul::detail::instance_of(GlobalCl::queue()));
+	copy_tests<cl_rul::Kernel>();
+}
+
+TEST_CASE("copy boxes between buffers - Mapped", "[copy]") {
+	copy_tests<cl_rul::Mapped>();
+}
+
+TEST_CASE("copy boxes between buffers - Automatic", "[copy]") {
+	copy_tests<cl_rul::Automatic>();
+}
+
+TEST_CASE("copy boxes between buffers - Runtime", "[copy][runtime]") {
+	copy_tests<cl_rul::Runtime>();
+}
+
+TEST_CASE("copy boxes within a buffer", "[copy]") {
+	const cl_rul::Extent size = { 16u, 8u, 1u };
+	std::vector<cl_float> host(size.size());
+	for(size_t i = 0; i < host.size(); ++i) host[i] = (cl_float)i;
+
+	cl_int errcode;
+	cl_mem buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, host.size() * sizeof(cl_float), host.data(), &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	// the left half onto the right half
+	const cl_rul::Box left = { { 0u,0u,0u },{ 8u,8u,1u } };
+	cl_rul::copy_rect<cl_float, cl_rul::ClRect>(cl_rul::no_event, GlobalCl::queue(), buffer, size, left, buffer, size, { 8u,0u,0u });
+	for(size_t y = 0; y < size.ys; ++y) {
+		for(size_t x = 8; x < size.xs; ++x) host[y * size.xs + x] = host[y * size.xs + x - 8];
+	}
+
+	std::vector<cl_float> result(size.size());
+	REQUIRE(clEnqueueReadBuffer(GlobalCl::queue(), buffer, CL_TRUE, 0, result.size() * sizeof(cl_float), result.data(), 0, nullptr, nullptr) == CL_SUCCESS);
+	check_1D(host.data(), result.data(), result.size());
+
+	clReleaseMemObject(buffer);
+}
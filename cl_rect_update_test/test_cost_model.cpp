@@ -0,0 +1,129 @@
+#include "../ext/catch.hpp"
+
+#include "global_cl.h"
+#include "test_utils.h"
+
+#include <cstdio>
+
+using cl_rul::detail::method_id;
+
+namespace {
+	// cheap calls but expensive rows for ClRect, expensive calls but free rows for Kernel
+	cl_rul::transfer_costs synthetic_costs() {
+		return { { 0.0, 10.0, 1000.0 }, { 5.0, 1.0, 1000.0 }, { 50.0, 0.0, 1000.0 } };
+	}
+}
+
+TEST_CASE("cost model method selection", "[cost_model]") {
+	const cl_rul::transfer_costs costs = synthetic_costs();
+
+	// individual: 20, clrect: 7, kernel: 50
+	REQUIRE(cl_rul::detail::select_method(costs, { { 0u,0u,0u },{ 4u,2u,1u } }, 4) == method_id::ClRect);
+	// individual: 1000, clrect: 105, kernel: 50
+	REQUIRE(cl_rul::detail::select_method(costs, { { 0u,0u,0u },{ 1u,100u,1u } }, 4) == method_id::Kernel);
+	// 3D boxes count every row of every slice
+	REQUIRE(cl_rul::detail::select_method(costs, { { 0u,0u,0u },{ 1u,10u,10u } }, 4) == method_id::Kernel);
+
+	REQUIRE(cl_rul::detail::is_linear({ 8u,8u,8u }, { { 2u,3u,4u },{ 5u,1u,1u } }));
+	REQUIRE(cl_rul::detail::is_linear({ 8u,8u,8u }, { { 0u,3u,4u },{ 8u,4u,1u } }));
+	REQUIRE(cl_rul::detail::is_linear({ 8u,8u,8u }, { { 0u,0u,2u },{ 8u,8u,3u } }));
+	REQUIRE_FALSE(cl_rul::detail::is_linear({ 8u,8u,8u }, { { 0u,3u,4u },{ 7u,4u,1u } }));
+	REQUIRE_FALSE(cl_rul::detail::is_linear({ 8u,8u,8u }, { { 0u,3u,2u },{ 8u,4u,2u } }));
+}
+
+TEST_CASE("cost model profile round trip", "[cost_model]") {
+	cl_rul::cost_model model = cl_rul::cost_model::defaults();
+	model.download = synthetic_costs();
+
+	const char* filename = "cl_rul_test_cost_profile.txt";
+	REQUIRE(model.save(filename));
+
+	cl_rul::cost_model loaded = cl_rul::cost_model::defaults();
+	REQUIRE(loaded.load(filename));
+	REQUIRE(loaded.download.clrect.latency == model.download.clrect.latency);
+	REQUIRE(loaded.download.kernel.latency == model.download.kernel.latency);
+	REQUIRE(loaded.upload.individual.row_cost == model.upload.individual.row_cost);
+	std::remove(filename);
+
+	// version 1 profiles have no copy costs
+	FILE* fp = fopen(filename, "w");
+	REQUIRE(fp != nullptr);
+	fprintf(fp, "cl_rul_cost_model 1\n");
+	for(int i = 0; i < 6; ++i) fprintf(fp, "1 2 3\n");
+	fclose(fp);
+	loaded.copy = synthetic_costs();
+	REQUIRE(loaded.load(filename));
+	REQUIRE(loaded.download.kernel.bandwidth == 3.0);
+	REQUIRE(loaded.copy.kernel.latency == cl_rul::cost_model::defaults().copy.kernel.latency);
+	std::remove(filename);
+
+	REQUIRE_FALSE(loaded.load("cl_rul_test_missing_cost_profile.txt"));
+}
+
+TEST_CASE("automatic method follows the cost model", "[cost_model][2D]") {
+	constexpr size_t TEST_L = 5;
+
+	cl_float host_buffer[TEST_L * TEST_L];
+	for(size_t i = 0; i < TEST_L * TEST_L; ++i) host_buffer[i] = (cl_float)i;
+
+	cl_int errcode;
+	cl_mem device_buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(host_buffer), host_buffer, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	const cl_rul::cost_model previous = cl_rul::get_cost_model();
+	cl_rul::cost_model model = previous;
+
+	SECTION("individual") {
+		model.upload.individual = { 0.0, 0.0, 1e9 };
+		model.download.individual = { 0.0, 0.0, 1e9 };
+	}
+	SECTION("clrect") {
+		model.upload.clrect = { 0.0, 0.0, 1e9 };
+		model.download.clrect = { 0.0, 0.0, 1e9 };
+	}
+	cl_rul::set_cost_model(model);
+
+	cl_float to_upload[4] = { 100.f, 101.f, 102.f, 103.f };
+	cl_rul::upload_rect<cl_float>(GlobalCl::queue(), device_buffer, { TEST_L,TEST_L,1u }, { { 1u,2u,0u },{ 2u,2u,1u } }, to_upload);
+
+	cl_float downloaded[4];
+	cl_rul::download_rect<cl_float>(GlobalCl::queue(), device_buffer, { TEST_L,TEST_L,1u }, { { 1u,2u,0u },{ 2u,2u,1u } }, downloaded);
+	clFinish(GlobalCl::queue());
+
+	cl_rul::set_cost_model(previous);
+	check_1D(to_upload, downloaded, 4);
+
+	clReleaseMemObject(device_buffer);
+}
+
+TEST_CASE("runtime method converges on repeated shapes", "[cost_model][runtime]") {
+	constexpr size_t TEST_L = 16;
+
+	cl_float host_buffer[TEST_L * TEST_L];
+	for(size_t i = 0; i < TEST_L * TEST_L; ++i) host_buffer[i] = (cl_float)i;
+
+	cl_int errcode;
+	cl_mem device_buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(host_buffer), host_buffer, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	// the Runtime method only samples once the kernels are compiled
+	cl_rul::detail::build_all_transfer_kernels<cl_float>(cl_rul::detail::instance_of(GlobalCl::queue()));
+
+	const cl_rul::Box column = { { 3u,0u,0u },{ 1u,TEST_L,1u } };
+	for(int step = 0; step < 4 * cl_rul::detail::RUNTIME_TRIALS; ++step) {
+		cl_float to_upload[TEST_L], downloaded[TEST_L];
+		for(size_t i = 0; i < TEST_L; ++i) to_upload[i] = (cl_float)(step * 100 + i);
+
+		cl_rul::upload_rect<cl_float, cl_rul::Runtime>(GlobalCl::queue(), device_buffer, { TEST_L,TEST_L,1u }, column, to_upload);
+		cl_rul::download_rect<cl_float, cl_rul::Runtime>(GlobalCl::queue(), device_buffer, { TEST_L,TEST_L,1u }, column, downloaded);
+		clFinish(GlobalCl::queue());
+
+		check_1D(to_upload, downloaded, TEST_L);
+	}
+
+	method_id chosen;
+	REQUIRE(cl_rul::detail::instance_of(GlobalCl::queue()).get_upload_tuner().converged(cl_rul::detail::make_tuning_key(column, sizeof(cl_float)), chosen));
+	REQUIRE(cl_rul::detail::instance_of(GlobalCl::queue()).get_download_tuner().converged(cl_rul::detail::make_tuning_key(column, sizeof(cl_float)), chosen));
+
+	clReleaseMemObject(device_buffer);
+}
@@ -0,0 +1,120 @@
+#include "../ext/catch.hpp"
+
+#include "global_cl.h"
+#include "test_utils.h"
+
+#include <vector>
+
+namespace {
+	const cl_rul::Extent buffer_size = { 11u, 10u, 9u };
+	const cl_rul::Box inner = { { 2u,2u,2u },{ 6u,5u,4u } };
+	constexpr size_t WIDTH = 2;
+
+	cl_float halo_value(size_t x, size_t y, size_t z) {
+		return (cl_float)(x + 100 * y + 10000 * z);
+	}
+
+	// elements of "layout" in packed order, read from a host copy of the buffer
+	std::vector<cl_float> packed(const std::vector<cl_float>& grid, const cl_rul::halo_layout& layout, bool ghost) {
+		std::vector<cl_float> ret;
+		for(const cl_rul::halo_part& part : layout.parts) {
+			const cl_rul::Box& b = ghost ? part.ghost : part.boundary;
+			REQUIRE(ret.size() == part.offset);
+			for(size_t z = b.origin.z; z < b.origin.z + b.extent.zs; ++z) {
+				for(size_t y = b.origin.y; y < b.origin.y + b.extent.ys; ++y) {
+					for(size_t x = b.origin.x; x < b.origin.x + b.extent.xs; ++x) {
+						ret.push_back(grid[buffer_size.row_offset(y, z) + x]);
+					}
+				}
+			}
+		}
+		return ret;
+	}
+}
+
+TEST_CASE("halo layouts", "[halo]") {
+	const cl_rul::halo_layout faces = cl_rul::make_halo_layout(inner, WIDTH);
+	REQUIRE(faces.parts.size() == 6);
+	REQUIRE(faces.find(0, 0, -1) == 0);
+	REQUIRE(faces.find(-1, 0, 0) == 2);
+	REQUIRE(faces.find(0, 0, 1) == 5);
+	REQUIRE(faces.find(1, 1, 0) == -1);
+	REQUIRE(faces.size == 2 * WIDTH * (6 * 5 + 6 * 4 + 5 * 4));
+
+	const cl_rul::halo_layout all = cl_rul::make_halo_layout(inner, WIDTH, cl_rul::halo_parts::All);
+	REQUIRE(all.parts.size() == 26);
+	size_t offset = 0;
+	for(const cl_rul::halo_part& part : all.parts) {
+		REQUIRE(part.offset == offset);
+		offset += part.ghost.size();
+		// a part matches the opposite part of the neighbour
+		REQUIRE(part.boundary.extent.xs == part.ghost.extent.xs);
+		REQUIRE(part.boundary.extent.ys == part.ghost.extent.ys);
+		REQUIRE(part.boundary.extent.zs == part.ghost.extent.zs);
+		REQUIRE(all.find(-part.dx, -part.dy, -part.dz) >= 0);
+	}
+	REQUIRE(all.size == offset);
+	REQUIRE(all.size == (6 + 2 * WIDTH) * (5 + 2 * WIDTH) * (4 + 2 * WIDTH) - inner.size());
+
+	const cl_rul::halo_part& corner = all.parts[all.find(1, -1, 1)];
+	REQUIRE(corner.ghost.origin.x == 8u);
+	REQUIRE(corner.ghost.origin.y == 0u);
+	REQUIRE(corner.ghost.origin.z == 6u);
+	REQUIRE(corner.boundary.origin.x == 6u);
+	REQUIRE(corner.boundary.origin.y == 2u);
+	REQUIRE(corner.boundary.origin.z == 4u);
+}
+
+TEST_CASE("halo pack / unpack", "[halo][3D]") {
+	std::vector<cl_float> host_buffer(buffer_size.size());
+	for(size_t z = 0; z < buffer_size.zs; ++z) {
+		for(size_t y = 0; y < buffer_size.ys; ++y) {
+			for(size_t x = 0; x < buffer_size.xs; ++x) {
+				host_buffer[buffer_size.row_offset(y, z) + x] = halo_value(x, y, z);
+			}
+		}
+	}
+
+	cl_int errcode;
+	cl_mem device_buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, host_buffer.size() * sizeof(cl_float), host_buffer.data(), &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	for(cl_rul::halo_parts which : { cl_rul::halo_parts::Faces, cl_rul::halo_parts::All }) {
+		const cl_rul::halo_layout layout = cl_rul::make_halo_layout(inner, WIDTH, which);
+
+		// pack the boundary
+		std::vector<cl_float> boundary(layout.size);
+		cl_event ev = cl_rul::pack_halo(GlobalCl::queue(), device_buffer, buffer_size, inner, WIDTH, which, boundary.data());
+		REQUIRE(clWaitForEvents(1, &ev) == CL_SUCCESS);
+		clReleaseEvent(ev);
+		std::vector<cl_float> expected_boundary = packed(host_buffer, layout, false);
+		check_1D(expected_boundary.data(), boundary.data(), boundary.size());
+
+		// unpack into the ghost layers
+		std::vector<cl_float> ghost(layout.size);
+		for(size_t i = 0; i < ghost.size(); ++i) ghost[i] = -(cl_float)(i + 1);
+		ev = cl_rul::unpack_halo(GlobalCl::queue(), device_buffer, buffer_size, layout, ghost.data());
+		clReleaseEvent(ev);
+
+		std::vector<cl_float> result(host_buffer.size());
+		REQUIRE(clEnqueueReadBuffer(GlobalCl::queue(), device_buffer, CL_TRUE, 0, result.size() * sizeof(cl_float), result.data(), 0, nullptr, nullptr) == CL_SUCCESS);
+		std::vector<cl_float> unpacked = packed(result, layout, true);
+		check_1D(ghost.data(), unpacked.data(), ghost.size());
+		// everything else is unchanged
+		for(const cl_rul::halo_part& part : layout.parts) {
+			const cl_rul::Box& b = part.ghost;
+			for(size_t z = b.origin.z; z < b.origin.z + b.extent.zs; ++z) {
+				for(size_t y = b.origin.y; y < b.origin.y + b.extent.ys; ++y) {
+					for(size_t x = b.origin.x; x < b.origin.x + b.extent.xs; ++x) {
+						result[buffer_size.row_offset(y, z) + x] = halo_value(x, y, z);
+					}
+				}
+			}
+		}
+		check_1D(host_buffer.data(), result.data(), result.size());
+
+		REQUIRE(clEnqueueWriteBuffer(GlobalCl::queue(), device_buffer, CL_TRUE, 0, host_buffer.size() * sizeof(cl_float), host_buffer.data(), 0, nullptr, nullptr) == CL_SUCCESS);
+	}
+
+	clReleaseMemObject(device_buffer);
+}
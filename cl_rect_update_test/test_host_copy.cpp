@@ -0,0 +1,60 @@
+#include "../ext/catch.hpp"
+
+#include "global_cl.h"
+#include "test_utils.h"
+
+#include <vector>
+
+namespace {
+	template<typename T>
+	void host_copy_test(const cl_rul::Extent& grid, const cl_rul::Box& box) {
+		std::vector<T> host_grid(grid.size());
+		for(size_t i = 0; i < host_grid.size(); ++i) host_grid[i] = (T)(i % 127);
+		const cl_rul::Pitch grid_pitch = cl_rul::Pitch::of(grid);
+		const size_t origin = grid.row_offset(box.origin.y, box.origin.z) + box.origin.x;
+
+		std::vector<T> packed(box.size());
+		cl_rul::host::pack(packed.data(), host_grid.data() + origin, grid_pitch, box.extent);
+		size_t i = 0;
+		for(size_t z = box.origin.z; z < box.origin.z + box.extent.zs; ++z) {
+			for(size_t y = box.origin.y; y < box.origin.y + box.extent.ys; ++y) {
+				for(size_t x = box.origin.x; x < box.origin.x + box.extent.xs; ++x) {
+					REQUIRE(packed[i++] == host_grid[grid.row_offset(y, z) + x]);
+				}
+			}
+		}
+
+		std::vector<T> expected(host_grid);
+		for(size_t j = 0; j < packed.size(); ++j) packed[j] = (T)(j % 113 + 1);
+		i = 0;
+		for(size_t z = box.origin.z; z < box.origin.z + box.extent.zs; ++z) {
+			for(size_t y = box.origin.y; y < box.origin.y + box.extent.ys; ++y) {
+				for(size_t x = box.origin.x; x < box.origin.x + box.extent.xs; ++x) {
+					expected[grid.row_offset(y, z) + x] = packed[i++];
+				}
+			}
+		}
+		cl_rul::host::unpack(host_grid.data() + origin, grid_pitch, packed.data(), box.extent);
+		check_1D(expected.data(), host_grid.data(), expected.size());
+	}
+}
+
+TEST_CASE("host pack / unpack", "[host]") {
+	SECTION("small pitched box") {
+		host_copy_test<cl_float>({ 17u, 9u, 5u }, { { 3u,2u,1u },{ 11u,5u,3u } });
+	}
+	SECTION("single element rows") {
+		host_copy_test<cl_char>({ 33u, 20u, 3u }, { { 7u,1u,0u },{ 1u,18u,3u } });
+		host_copy_test<cl_double>({ 33u, 20u, 3u }, { { 7u,1u,0u },{ 1u,18u,3u } });
+	}
+	SECTION("contiguous slices") {
+		host_copy_test<cl_int>({ 64u, 64u, 8u }, { { 0u,0u,2u },{ 64u,64u,4u } });
+	}
+	SECTION("large box using non-temporal stores and several threads") {
+		REQUIRE(513u * 300u * 9u * sizeof(cl_float) >= cl_rul::host::PARALLEL_MIN_BYTES);
+		host_copy_test<cl_float>({ 515u, 301u, 12u }, { { 1u,1u,2u },{ 513u,300u,9u } });
+	}
+	SECTION("one long row split across threads") {
+		host_copy_test<cl_short>({ 3u << 20, 1u, 1u }, { { 5u,0u,0u },{ (3u << 20) - 9u,1u,1u } });
+	}
+}
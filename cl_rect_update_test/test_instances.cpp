@@ -0,0 +1,81 @@
+#include "../ext/catch.hpp"
+
+#include "global_cl.h"
+#include "test_utils.h"
+
+#include <thread>
+#include <vector>
+
+namespace {
+	const cl_rul::Extent buffer_size = { 64u, 32u, 4u };
+	const cl_rul::Box box = { { 3u,2u,1u },{ 40u,20u,2u } };
+
+	// Kernel round trip of "box", with every host transfer staged by the library instance of "queue"
+	void round_trip(cl_command_queue queue, cl_mem device_buffer, cl_float base, std::vector<cl_float>& downloaded) {
+		std::vector<cl_float> to_upload(box.size());
+		for(size_t i = 0; i < to_upload.size(); ++i) to_upload[i] = base + i;
+		downloaded.assign(box.size(), -1.f);
+		for(int r = 0; r < 4; ++r) {
+			cl_event ev = cl_rul::upload_rect<cl_float, cl_rul::Kernel>(queue, device_buffer, buffer_size, box, to_upload.data());
+			cl_event ev_download = cl_rul::download_rect<cl_float, cl_rul::Kernel>(queue, device_buffer, buffer_size, box, downloaded.data(), ev);
+			clWaitForEvents(1, &ev_download);
+			clReleaseEvent(ev_download);
+			clReleaseEvent(ev);
+		}
+	}
+}
+
+TEST_CASE("library instances per context and device", "[instances]") {
+	cl_device_id device;
+	REQUIRE(clGetCommandQueueInfo(GlobalCl::queue(), CL_QUEUE_DEVICE, sizeof(device), &device, nullptr) == CL_SUCCESS);
+
+	// a second context on the same device gets its own instance, created by its first transfer
+	cl_int errcode;
+	cl_context other_context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+	cl_command_queue other_queue = clCreateCommandQueue(other_context, device, 0, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	cl_rul::detail::cl_rul_context& lib = cl_rul::detail::instance_of(GlobalCl::queue());
+	cl_rul::detail::cl_rul_context& other_lib = cl_rul::detail::instance_of(other_queue);
+	REQUIRE(&lib != &other_lib);
+	REQUIRE(&lib == &cl_rul::detail::instance_of(GlobalCl::queue()));
+	REQUIRE(other_lib.get_cl_context() == other_context);
+
+	cl_mem device_buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE, buffer_size.size() * sizeof(cl_float), nullptr, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+	cl_mem other_buffer = clCreateBuffer(other_context, CL_MEM_READ_WRITE, buffer_size.size() * sizeof(cl_float), nullptr, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	SECTION("concurrent transfers") {
+		std::vector<cl_float> downloaded, other_downloaded;
+		std::thread other([&] { round_trip(other_queue, other_buffer, 5000.f, other_downloaded); });
+		round_trip(GlobalCl::queue(), device_buffer, 1000.f, downloaded);
+		other.join();
+
+		for(size_t i = 0; i < box.size(); ++i) {
+			REQUIRE(downloaded[i] == 1000.f + i);
+			REQUIRE(other_downloaded[i] == 5000.f + i);
+		}
+	}
+
+	SECTION("settings are per instance") {
+		cl_rul::cost_model model = cl_rul::cost_model::defaults();
+		model.upload.kernel.latency = 1234.0;
+		cl_rul::set_cost_model(other_queue, model);
+		REQUIRE(cl_rul::get_cost_model(other_queue).upload.kernel.latency == 1234.0);
+		REQUIRE(cl_rul::get_cost_model(GlobalCl::queue()).upload.kernel.latency != 1234.0);
+
+		cl_rul::set_pipelining(other_queue, 1, 4096);
+		REQUIRE(other_lib.get_pipelining().min_bytes == 1);
+		REQUIRE(other_lib.get_pipelining().copy_queue == nullptr);
+		REQUIRE(lib.get_pipelining().min_bytes == 0);
+	}
+
+	clReleaseMemObject(other_buffer);
+	clReleaseMemObject(device_buffer);
+	clFinish(other_queue);
+	cl_rul::reset_rect_update_lib(other_context, device);
+	clReleaseCommandQueue(other_queue);
+	clReleaseContext(other_context);
+}
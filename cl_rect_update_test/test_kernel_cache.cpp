@@ -0,0 +1,149 @@
+#include "../ext/catch.hpp"
+
+#include "global_cl.h"
+#include "test_utils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+TEST_CASE("kernel binaries are cached on disk", "[kernel_cache]") {
+	cl_device_id device;
+	REQUIRE(clGetCommandQueueInfo(GlobalCl::queue(), CL_QUEUE_DEVICE, sizeof(device), &device, nullptr) == CL_SUCCESS);
+
+	// a separate context, so its instance builds all kernels itself
+	cl_int errcode;
+	cl_context context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+	cl_command_queue queue = clCreateCommandQueue(context, device, 0, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	const char* directory = ".";
+	cl_rul::set_kernel_cache_directory(directory);
+
+	// only the kernels of one type, so all files written can be removed below
+	cl_rul::detail::cl_rul_context& lib = cl_rul::detail::instance_of(queue);
+	cl_rul::detail::build_all_transfer_kernels<cl_float>(lib);
+	const std::string path = cl_rul::detail::kernel_cache_path(directory, device, cl_rul::detail::get_program_source(false).c_str(), cl_rul::detail::transfer_kernel_options<cl_float>(lib, false));
+	REQUIRE(std::ifstream(path, std::ios::binary).good());
+
+	// a new instance loads the binaries, and its kernels transfer correctly
+	cl_rul::reset_rect_update_lib(context, device);
+	cl_rul::detail::build_all_transfer_kernels<cl_float>(cl_rul::detail::instance_of(queue));
+
+	const cl_rul::Extent buffer_size = { 32u, 16u, 1u };
+	const cl_rul::Box box = { { 2u,3u,0u },{ 20u,10u,1u } };
+	cl_mem device_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size.size() * sizeof(cl_float), nullptr, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	std::vector<cl_float> to_upload(box.size());
+	for(size_t i = 0; i < to_upload.size(); ++i) to_upload[i] = 1000.f + i;
+	std::vector<cl_float> downloaded(box.size(), -1.f);
+	cl_rul::upload_rect<cl_float, cl_rul::Kernel>(cl_rul::no_event, queue, device_buffer, buffer_size, box, to_upload.data());
+	cl_rul::download_rect<cl_float, cl_rul::Kernel>(cl_rul::no_event, queue, device_buffer, buffer_size, box, downloaded.data());
+	clFinish(queue);
+	check_1D(to_upload.data(), downloaded.data(), to_upload.size());
+
+	// remove the binaries of both programs built for cl_float
+	cl_rul::detail::cl_rul_context& reloaded = cl_rul::detail::instance_of(queue);
+	for(bool vectorized : { false, true }) {
+		if(vectorized && !cl_rul::detail::has_vector_kernels<cl_float>(reloaded)) continue;
+		std::remove(cl_rul::detail::kernel_cache_path(directory, device, cl_rul::detail::get_program_source(vectorized).c_str(), cl_rul::detail::transfer_kernel_options<cl_float>(reloaded, vectorized)).c_str());
+	}
+
+	cl_rul::set_kernel_cache_directory(nullptr);
+	clReleaseMemObject(device_buffer);
+	cl_rul::reset_rect_update_lib(context, device);
+	clReleaseCommandQueue(queue);
+	clReleaseContext(context);
+}
+
+TEST_CASE("eager initialization builds kernels in the background", "[kernel_cache]") {
+	cl_device_id device;
+	REQUIRE(clGetCommandQueueInfo(GlobalCl::queue(), CL_QUEUE_DEVICE, sizeof(device), &device, nullptr) == CL_SUCCESS);
+
+	cl_int errcode;
+	cl_context context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+	cl_command_queue queue = clCreateCommandQueue(context, device, 0, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	cl_rul::init_rect_update_lib(context, device, true);
+	cl_rul::detail::cl_rul_context& lib = cl_rul::detail::instance_of(queue);
+	REQUIRE(lib.transfer_kernels<cl_float>().programs[0].valid());
+	REQUIRE(lib.transfer_kernels<cl_char>().programs[0].valid());
+
+	// the first transfer waits for its program only
+	const cl_rul::Extent buffer_size = { 32u, 16u, 1u };
+	const cl_rul::Box box = { { 2u,3u,0u },{ 3u,10u,1u } };
+	cl_mem device_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size.size() * sizeof(cl_float), nullptr, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	std::vector<cl_float> to_upload(box.size());
+	for(size_t i = 0; i < to_upload.size(); ++i) to_upload[i] = 1000.f + i;
+	std::vector<cl_float> downloaded(box.size(), -1.f);
+	cl_rul::upload_rect<cl_float, cl_rul::Kernel>(cl_rul::no_event, queue, device_buffer, buffer_size, box, to_upload.data());
+	cl_rul::download_rect<cl_float, cl_rul::Kernel>(cl_rul::no_event, queue, device_buffer, buffer_size, box, downloaded.data());
+	clFinish(queue);
+	check_1D(to_upload.data(), downloaded.data(), to_upload.size());
+
+	clReleaseMemObject(device_buffer);
+	cl_rul::reset_rect_update_lib(context, device); // waits for the builds still running
+	clReleaseCommandQueue(queue);
+	clReleaseContext(context);
+}
+
+TEST_CASE("transfers are served while kernels compile", "[kernel_cache]") {
+	cl_device_id device;
+	REQUIRE(clGetCommandQueueInfo(GlobalCl::queue(), CL_QUEUE_DEVICE, sizeof(device), &device, nullptr) == CL_SUCCESS);
+
+	// a new instance without any built kernels
+	cl_int errcode;
+	cl_context context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+	cl_command_queue queue = clCreateCommandQueue(context, device, 0, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	const cl_rul::Extent buffer_size = { 32u, 16u, 1u };
+	const cl_rul::Box box = { { 2u,3u,0u },{ 3u,10u,1u } };
+	cl_mem device_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size.size() * sizeof(cl_float), nullptr, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	// the first transfer starts the build and does not wait for it
+	std::vector<cl_float> to_upload(box.size());
+	for(size_t i = 0; i < to_upload.size(); ++i) to_upload[i] = 1000.f + i;
+	std::vector<cl_float> downloaded(box.size(), -1.f);
+	cl_rul::upload_rect<cl_float, cl_rul::Kernel>(cl_rul::no_event, queue, device_buffer, buffer_size, box, to_upload.data());
+	cl_rul::detail::cl_rul_context& lib = cl_rul::detail::instance_of(queue);
+	REQUIRE(lib.transfer_kernels<cl_float>().programs[0].valid());
+	cl_rul::download_rect<cl_float, cl_rul::Kernel>(cl_rul::no_event, queue, device_buffer, buffer_size, box, downloaded.data());
+	clFinish(queue);
+	check_1D(to_upload.data(), downloaded.data(), to_upload.size());
+
+	// once built, the kernels serve the transfers
+	lib.transfer_kernels<cl_float>().programs[0].wait();
+	REQUIRE(cl_rul::detail::transfer_kernels_ready<cl_float>(lib, box));
+	std::fill(downloaded.begin(), downloaded.end(), -1.f);
+	cl_rul::download_rect<cl_float, cl_rul::Kernel>(cl_rul::no_event, queue, device_buffer, buffer_size, box, downloaded.data());
+	clFinish(queue);
+	check_1D(to_upload.data(), downloaded.data(), to_upload.size());
+
+	clReleaseMemObject(device_buffer);
+	cl_rul::reset_rect_update_lib(context, device);
+	clReleaseCommandQueue(queue);
+	clReleaseContext(context);
+}
+
+#ifdef CL_RUL_EMBEDDED_KERNELS
+TEST_CASE("embedded kernel binaries are loaded", "[kernel_cache]") {
+	cl_device_id device;
+	REQUIRE(clGetCommandQueueInfo(GlobalCl::queue(), CL_QUEUE_DEVICE, sizeof(device), &device, nullptr) == CL_SUCCESS);
+
+	// requires the test device to be among the CL_RUL_EMBED_DEVICES the library was built for
+	cl_rul::detail::cl_rul_context& lib = cl_rul::detail::instance_of(GlobalCl::queue());
+	cl_program program = cl_rul::detail::load_embedded_program(GlobalCl::context(), device, cl_rul::detail::get_program_source(false), cl_rul::detail::transfer_kernel_options<cl_float>(lib, false));
+	REQUIRE(program != nullptr);
+	clReleaseProgram(program);
+}
+#endif
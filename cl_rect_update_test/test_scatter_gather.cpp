@@ -0,0 +1,68 @@
+#include "../ext/catch.hpp"
+
+#include "global_cl.h"
+#include "test_utils.h"
+
+#include <vector>
+
+TEST_CASE("scatter / gather transfers", "[scatter][3D]") {
+	const cl_rul::Extent buffer_size = { 16u, 8u, 4u };
+
+	std::vector<cl_float> host_buffer(buffer_size.size());
+	for(size_t i = 0; i < host_buffer.size(); ++i) host_buffer[i] = (cl_float)i;
+
+	cl_int errcode;
+	cl_mem device_buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, host_buffer.size() * sizeof(cl_float), host_buffer.data(), &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	// more than one work-group of scattered cells
+	std::vector<size_t> indices;
+	for(size_t i = 3; i < host_buffer.size(); i += 5) indices.push_back(i);
+	REQUIRE(indices.size() > cl_rul::detail::TRANSFER_WORK_GROUP_SIZE);
+
+	SECTION("linear indices") {
+		std::vector<cl_float> values(indices.size());
+		for(size_t i = 0; i < values.size(); ++i) values[i] = -(cl_float)(i + 1);
+		cl_event ev = cl_rul::scatter_upload(GlobalCl::queue(), device_buffer, indices.data(), indices.size(), values.data());
+		clReleaseEvent(ev);
+		for(size_t i = 0; i < indices.size(); ++i) host_buffer[indices[i]] = values[i];
+
+		std::vector<cl_float> result(host_buffer.size());
+		REQUIRE(clEnqueueReadBuffer(GlobalCl::queue(), device_buffer, CL_TRUE, 0, result.size() * sizeof(cl_float), result.data(), 0, nullptr, nullptr) == CL_SUCCESS);
+		check_1D(host_buffer.data(), result.data(), result.size());
+
+		std::vector<cl_float> gathered(indices.size());
+		ev = cl_rul::gather_download(GlobalCl::queue(), device_buffer, indices.data(), indices.size(), gathered.data());
+		REQUIRE(clWaitForEvents(1, &ev) == CL_SUCCESS);
+		clReleaseEvent(ev);
+		check_1D(values.data(), gathered.data(), values.size());
+	}
+
+	SECTION("points") {
+		const cl_rul::Point points[] = { { 0u,0u,0u }, { 15u,7u,3u }, { 4u,2u,1u }, { 9u,0u,2u } };
+		const size_t count = sizeof(points) / sizeof(points[0]);
+		const cl_char4 values[count] = { { 1,2,3,4 }, { 5,6,7,8 }, { 9,10,11,12 }, { 13,14,15,16 } };
+
+		std::vector<cl_char4> host_chars(buffer_size.size(), { 0,0,0,0 });
+		cl_mem char_buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, host_chars.size() * sizeof(cl_char4), host_chars.data(), &errcode);
+		REQUIRE(errcode == CL_SUCCESS);
+
+		cl_event ev = cl_rul::scatter_upload(GlobalCl::queue(), char_buffer, buffer_size, points, count, values);
+		clReleaseEvent(ev);
+
+		cl_char4 gathered[count];
+		ev = cl_rul::gather_download(GlobalCl::queue(), char_buffer, buffer_size, points, count, gathered);
+		REQUIRE(clWaitForEvents(1, &ev) == CL_SUCCESS);
+		clReleaseEvent(ev);
+		for(size_t i = 0; i < count; ++i) REQUIRE(gathered[i] == values[i]);
+
+		clReleaseMemObject(char_buffer);
+	}
+
+	SECTION("nothing to transfer") {
+		REQUIRE(cl_rul::scatter_upload<cl_float>(GlobalCl::queue(), device_buffer, indices.data(), 0, nullptr) == nullptr);
+		REQUIRE(cl_rul::gather_download<cl_float>(GlobalCl::queue(), device_buffer, indices.data(), 0, nullptr) == nullptr);
+	}
+
+	clReleaseMemObject(device_buffer);
+}
@@ -0,0 +1,127 @@
+#include "../ext/catch.hpp"
+
+#include "global_cl.h"
+#include "test_utils.h"
+
+#include <algorithm>
+#include <vector>
+
+TEST_CASE("staging buffers are reused once their transfer completed", "[staging]") {
+	cl_rul::detail::cl_rul_context& ctx = cl_rul::detail::instance_of(GlobalCl::queue());
+
+	cl_mem first = ctx.acquire_staging_buffer(3000000);
+	cl_mem second = ctx.acquire_staging_buffer(3000000);
+	REQUIRE(first != second);
+
+	cl_event ev_done;
+	REQUIRE(clEnqueueMarkerWithWaitList(GlobalCl::queue(), 0, nullptr, &ev_done) == CL_SUCCESS);
+	ctx.release_staging_buffer(first, ev_done);
+	ctx.release_staging_buffer(second, ev_done);
+	clReleaseEvent(ev_done);
+	clFinish(GlobalCl::queue());
+
+	// same size class, which none of the other tests use
+	cl_mem reused = ctx.acquire_staging_buffer(cl_rul::detail::staging_pool::size_class(3000000));
+	REQUIRE((reused == first || reused == second));
+
+	REQUIRE(clEnqueueMarkerWithWaitList(GlobalCl::queue(), 0, nullptr, &ev_done) == CL_SUCCESS);
+	ctx.release_staging_buffer(reused, ev_done);
+	clReleaseEvent(ev_done);
+	clFinish(GlobalCl::queue());
+}
+
+TEST_CASE("kernel transfers in flight use separate staging buffers", "[staging][2D]") {
+	const cl_rul::Extent buffer_size = { 64u, 64u, 1u };
+
+	std::vector<cl_float> host_buffer(buffer_size.size(), 0.f);
+	cl_int errcode;
+	cl_mem device_buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, host_buffer.size() * sizeof(cl_float), host_buffer.data(), &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	// differently sized boxes, all enqueued before any of them completes
+	const cl_rul::Box boxes[3] = { { { 1u,1u,0u },{ 30u,20u,1u } }, { { 1u,30u,0u },{ 5u,30u,1u } }, { { 40u,2u,0u },{ 20u,50u,1u } } };
+	std::vector<cl_float> to_upload[3];
+	for(int b = 0; b < 3; ++b) {
+		to_upload[b].resize(boxes[b].size());
+		for(size_t i = 0; i < to_upload[b].size(); ++i) to_upload[b][i] = (cl_float)(1000 * (b + 1) + i);
+		cl_rul::upload_rect<cl_float, cl_rul::Kernel>(GlobalCl::queue(), device_buffer, buffer_size, boxes[b], to_upload[b].data());
+	}
+
+	std::vector<cl_float> downloaded[3];
+	for(int b = 0; b < 3; ++b) {
+		downloaded[b].resize(boxes[b].size());
+		cl_rul::download_rect<cl_float, cl_rul::Kernel>(GlobalCl::queue(), device_buffer, buffer_size, boxes[b], downloaded[b].data());
+	}
+	clFinish(GlobalCl::queue());
+
+	for(int b = 0; b < 3; ++b) check_1D(to_upload[b].data(), downloaded[b].data(), boxes[b].size());
+
+	clReleaseMemObject(device_buffer);
+}
+
+TEST_CASE("pinned host staging", "[staging][pinned][2D]") {
+	const cl_rul::Extent buffer_size = { 48u, 32u, 1u };
+	const cl_rul::Box box = { { 3u,2u,0u },{ 40u,25u,1u } };
+	const cl_rul::Box rows = { { 0u,4u,0u },{ 48u,3u,1u } };
+
+	std::vector<cl_float> host_buffer(buffer_size.size(), 0.f);
+	cl_int errcode;
+	cl_mem device_buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, host_buffer.size() * sizeof(cl_float), host_buffer.data(), &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	SECTION("staged through pinned memory") {
+		cl_rul::set_pinned_staging(true);
+		for(const cl_rul::Box& b : { box, rows }) {
+			std::vector<cl_float> to_upload(b.size());
+			for(size_t i = 0; i < to_upload.size(); ++i) to_upload[i] = (cl_float)(500 + i);
+			cl_rul::upload_rect<cl_float, cl_rul::Kernel>(GlobalCl::queue(), device_buffer, buffer_size, b, to_upload.data());
+			// the upload copied the data, so the source may be overwritten right away
+			std::fill(to_upload.begin(), to_upload.end(), -1.f);
+
+			std::vector<cl_float> downloaded(b.size());
+			cl_event ev = cl_rul::download_rect<cl_float, cl_rul::Kernel>(GlobalCl::queue(), device_buffer, buffer_size, b, downloaded.data());
+			REQUIRE(clWaitForEvents(1, &ev) == CL_SUCCESS);
+			clReleaseEvent(ev);
+
+			for(size_t i = 0; i < to_upload.size(); ++i) REQUIRE(downloaded[i] == (cl_float)(500 + i));
+		}
+		cl_rul::set_pinned_staging(false);
+	}
+
+	SECTION("filled in place") {
+		cl_rul::pinned_region<cl_float> region = cl_rul::acquire_pinned_region<cl_float>(box.size());
+		REQUIRE(region.count == box.size());
+		for(size_t i = 0; i < region.count; ++i) region.data[i] = (cl_float)(700 + i);
+		cl_event ev = cl_rul::upload_rect<cl_float, cl_rul::Kernel>(GlobalCl::queue(), device_buffer, buffer_size, box, region.data);
+		cl_rul::release_pinned_region(region, ev);
+		clReleaseEvent(ev);
+
+		cl_rul::pinned_region<cl_float> target = cl_rul::acquire_pinned_region<cl_float>(box.size());
+		cl_rul::download_rect<cl_float, cl_rul::ClRect>(GlobalCl::queue(), device_buffer, buffer_size, box, target.data);
+		clFinish(GlobalCl::queue());
+		for(size_t i = 0; i < target.count; ++i) REQUIRE(target.data[i] == (cl_float)(700 + i));
+		cl_rul::release_pinned_region(target);
+	}
+
+	clReleaseMemObject(device_buffer);
+}
+
+TEST_CASE("acquiring a staging buffer never waits for a gated transfer", "[staging]") {
+	// buffers whose commands wait for a user event of the caller, which only opens once all of them have been acquired
+	cl_int errcode;
+	cl_event gate = clCreateUserEvent(GlobalCl::context(), &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	cl_rul::detail::staging_pool pool;
+	std::vector<cl_mem> gated;
+	for(size_t i = 0; i < cl_rul::detail::MAX_STAGING_BUFFERS_IN_FLIGHT; ++i) gated.push_back(pool.acquire(GlobalCl::context(), 1000));
+	for(cl_mem buffer : gated) pool.release(buffer, gate);
+
+	cl_mem extra = pool.acquire(GlobalCl::context(), 1000);
+	REQUIRE(std::find(gated.begin(), gated.end(), extra) == gated.end());
+	pool.release(extra, nullptr);
+
+	REQUIRE(clSetUserEventStatus(gate, CL_COMPLETE) == CL_SUCCESS);
+	clReleaseEvent(gate);
+	pool.reset();
+}
@@ -41,3 +41,29 @@ inline void print_2D(T a[TEST_L][TEST_L], const char* name = nullptr) {
 	printf("\n");
 }
 
+
+/// Enables pipelined Kernel transfers until the end of the scope, also when a REQUIRE fails, so later tests run without them.
+class pipelining_scope {
+public:
+	pipelining_scope(size_t min_bytes, size_t chunk_bytes, cl_command_queue copy_queue = nullptr) {
+		cl_rul::set_pipelining(min_bytes, chunk_bytes, copy_queue);
+	}
+	~pipelining_scope() {
+		cl_rul::set_pipelining(0);
+	}
+	pipelining_scope(const pipelining_scope&) = delete;
+	pipelining_scope& operator=(const pipelining_scope&) = delete;
+};
+
+/// Stages host data through pinned memory until the end of the scope, also when a REQUIRE fails.
+class pinned_staging_scope {
+public:
+	pinned_staging_scope() {
+		cl_rul::set_pinned_staging(true);
+	}
+	~pinned_staging_scope() {
+		cl_rul::set_pinned_staging(false);
+	}
+	pinned_staging_scope(const pinned_staging_scope&) = delete;
+	pinned_staging_scope& operator=(const pinned_staging_scope&) = delete;
+};
@@ -0,0 +1,184 @@
+#include "../ext/catch.hpp"
+
+#include "global_cl.h"
+#include "test_utils.h"
+
+#include <vector>
+
+namespace {
+	const cl_rul::Extent buffer_size = { 16u, 8u, 4u };
+
+	// the upload waits for a user event, the download is chained to the upload through its wait list only
+	template<typename Method>
+	void wait_list_test(cl_command_queue queue, cl_mem device_buffer, const cl_rul::Box& box) {
+		std::vector<cl_float> to_upload(box.size());
+		for(size_t i = 0; i < to_upload.size(); ++i) to_upload[i] = 1000.f + i;
+
+		cl_int errcode;
+		cl_event gate = clCreateUserEvent(GlobalCl::context(), &errcode);
+		REQUIRE(errcode == CL_SUCCESS);
+
+		cl_event ev_upload = cl_rul::upload_rect<cl_float, Method>(queue, device_buffer, buffer_size, box, to_upload.data(), gate);
+		std::vector<cl_float> downloaded(box.size(), -1.f);
+		cl_event ev_download = cl_rul::download_rect<cl_float, Method>(queue, device_buffer, buffer_size, box, downloaded.data(), ev_upload);
+		clFlush(queue);
+
+		cl_int status;
+		REQUIRE(clGetEventInfo(ev_download, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr) == CL_SUCCESS);
+		REQUIRE(status != CL_COMPLETE);
+
+		REQUIRE(clSetUserEventStatus(gate, CL_COMPLETE) == CL_SUCCESS);
+		REQUIRE(clWaitForEvents(1, &ev_download) == CL_SUCCESS);
+		check_1D(to_upload.data(), downloaded.data(), to_upload.size());
+
+		clReleaseEvent(ev_download);
+		clReleaseEvent(ev_upload);
+		clReleaseEvent(gate);
+	}
+
+	template<typename Method>
+	void wait_list_tests(cl_command_queue queue, cl_mem device_buffer) {
+		const cl_rul::Box inner_box = { { 1u,1u,1u },{ 12u,6u,2u } };
+		const cl_rul::Box column = { { 3u,0u,0u },{ 1u,8u,4u } };
+		const cl_rul::Box full_rows = { { 0u,2u,1u },{ 16u,3u,1u } };
+
+		wait_list_test<Method>(queue, device_buffer, inner_box);
+		wait_list_test<Method>(queue, device_buffer, column);
+		wait_list_test<Method>(queue, device_buffer, full_rows);
+	}
+}
+
+TEST_CASE("transfers with wait lists", "[wait_list][3D]") {
+	cl_device_id device;
+	REQUIRE(clGetCommandQueueInfo(GlobalCl::queue(), CL_QUEUE_DEVICE, sizeof(device), &device, nullptr) == CL_SUCCESS);
+
+	// internal steps must be chained explicitly on an out-of-order queue; fall back to in-order if it is not supported
+	cl_int errcode;
+	cl_command_queue queue = clCreateCommandQueue(GlobalCl::context(), device, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &errcode);
+	if(errcode != CL_SUCCESS) queue = clCreateCommandQueue(GlobalCl::context(), device, 0, &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	std::vector<cl_float> host_buffer(buffer_size.size(), 0.f);
+	cl_mem device_buffer = clCreateBuffer(GlobalCl::context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, host_buffer.size() * sizeof(cl_float), host_buffer.data(), &errcode);
+	REQUIRE(errcode == CL_SUCCESS);
+
+	SECTION("[individual]") {
+		wait_list_tests<cl_rul::Individual>(queue, device_buffer);
+	}
+	SECTION("[rect]") {
+		wait_list_tests<cl_rul::ClRect>(queue, device_buffer);
+	}
+	SECTION("[kernel]") {
+		wait_list_tests<cl_rul::Kernel>(queue, device_buffer);
+	}
+	SECTION("[automatic]") {
+		wait_list_tests<cl_rul::Automatic>(queue, device_buffer);
+	}
+
+	SECTION("[runtime]") {
+		wait_list_tests<cl_rul::Runtime>(queue, device_buffer);
+	}
+	SECTION("[pipelined]") {
+		pipelining_scope pipelining(1, buffer_size.xs * sizeof(cl_float));
+		wait_list_tests<cl_rul::Kernel>(queue, device_buffer);
+	}
+
+	SECTION("batched") {
+		const cl_rul::Box boxes[] = { { { 1u,1u,1u },{ 12u,6u,2u } }, { { 0u,0u,3u },{ 2u,8u,1u } } };
+		std::vector<cl_float> to_upload(boxes[0].size() + boxes[1].size());
+		for(size_t i = 0; i < to_upload.size(); ++i) to_upload[i] = 1000.f + i;
+		cl_event gate = clCreateUserEvent(GlobalCl::context(), &errcode);
+		REQUIRE(errcode == CL_SUCCESS);
+		cl_event ev_upload = cl_rul::upload_rects(queue, device_buffer, buffer_size, boxes, 2, to_upload.data(), gate);
+		std::vector<cl_float> downloaded(to_upload.size(), -1.f);
+		cl_event ev_download = cl_rul::download_rects(queue, device_buffer, buffer_size, boxes, 2, downloaded.data(), ev_upload);
+		REQUIRE(clSetUserEventStatus(gate, CL_COMPLETE) == CL_SUCCESS);
+		REQUIRE(clWaitForEvents(1, &ev_download) == CL_SUCCESS);
+		check_1D(to_upload.data(), downloaded.data(), to_upload.size());
+		clReleaseEvent(ev_download);
+		clReleaseEvent(ev_upload);
+		clReleaseEvent(gate);
+	}
+
+	SECTION("more gated transfers than staging buffers in flight") {
+		cl_event gate = clCreateUserEvent(GlobalCl::context(), &errcode);
+		REQUIRE(errcode == CL_SUCCESS);
+		// the host data is only read once the gate opens, so every transfer keeps its own
+		std::vector<std::vector<cl_float>> to_upload;
+		std::vector<cl_event> events;
+		for(size_t y = 0; y < buffer_size.ys; ++y) {
+			for(size_t z = 0; z < buffer_size.zs; z += 2) {
+				const cl_rul::Box row_pair = { { 1u,y,z },{ 14u,1u,2u } };
+				to_upload.emplace_back(row_pair.size(), (cl_float)(y * 100 + z));
+				events.push_back(cl_rul::upload_rect<cl_float, cl_rul::Kernel>(queue, device_buffer, buffer_size, row_pair, to_upload.back().data(), gate));
+			}
+		}
+		REQUIRE(events.size() > cl_rul::detail::MAX_STAGING_BUFFERS_IN_FLIGHT);
+		REQUIRE(clSetUserEventStatus(gate, CL_COMPLETE) == CL_SUCCESS);
+		REQUIRE(clWaitForEvents((cl_uint)events.size(), events.data()) == CL_SUCCESS);
+
+		std::vector<cl_float> result(buffer_size.size());
+		REQUIRE(clEnqueueReadBuffer(queue, device_buffer, CL_TRUE, 0, result.size() * sizeof(cl_float), result.data(), 0, nullptr, nullptr) == CL_SUCCESS);
+		for(size_t z = 0; z < buffer_size.zs; ++z) {
+			for(size_t y = 0; y < buffer_size.ys; ++y) {
+				for(size_t x = 1; x < 15; ++x) REQUIRE(result[buffer_size.row_offset(y, z) + x] == (cl_float)(y * 100 + z / 2 * 2));
+			}
+		}
+		for(cl_event ev : events) clReleaseEvent(ev);
+		clReleaseEvent(gate);
+	}
+
+	SECTION("more gated pinned downloads than staging buffers in flight") {
+		pinned_staging_scope pinned;
+		std::vector<cl_float> initial(buffer_size.size());
+		for(size_t i = 0; i < initial.size(); ++i) initial[i] = (cl_float)i;
+		REQUIRE(clEnqueueWriteBuffer(queue, device_buffer, CL_TRUE, 0, initial.size() * sizeof(cl_float), initial.data(), 0, nullptr, nullptr) == CL_SUCCESS);
+
+		cl_event gate = clCreateUserEvent(GlobalCl::context(), &errcode);
+		REQUIRE(errcode == CL_SUCCESS);
+		// every read into pinned memory waits for the gate, so none of their buffers may be waited for
+		std::vector<cl_rul::Box> boxes;
+		std::vector<std::vector<cl_float>> downloaded;
+		std::vector<cl_event> events;
+		for(size_t y = 0; y < buffer_size.ys; ++y) {
+			for(size_t z = 0; z < buffer_size.zs; z += 2) {
+				boxes.push_back({ { 1u,y,z },{ 14u,1u,2u } });
+				downloaded.emplace_back(boxes.back().size(), -1.f);
+				events.push_back(cl_rul::download_rect<cl_float, cl_rul::Kernel>(queue, device_buffer, buffer_size, boxes.back(), downloaded.back().data(), gate));
+			}
+		}
+		REQUIRE(events.size() > cl_rul::detail::MAX_STAGING_BUFFERS_IN_FLIGHT);
+		REQUIRE(clSetUserEventStatus(gate, CL_COMPLETE) == CL_SUCCESS);
+		REQUIRE(clWaitForEvents((cl_uint)events.size(), events.data()) == CL_SUCCESS);
+
+		for(size_t b = 0; b < boxes.size(); ++b) {
+			const cl_rul::Box& box = boxes[b];
+			size_t i = 0;
+			for(size_t z = box.origin.z; z < box.origin.z + box.extent.zs; ++z) {
+				for(size_t x = 1; x < 15; ++x) REQUIRE(downloaded[b][i++] == initial[buffer_size.row_offset(box.origin.y, z) + x]);
+			}
+		}
+		for(cl_event ev : events) clReleaseEvent(ev);
+		clReleaseEvent(gate);
+	}
+
+	SECTION("scatter / gather") {
+		const size_t indices[] = { 5, 77, 130, 511 };
+		cl_float values[] = { 1.f, 2.f, 3.f, 4.f };
+		cl_event gate = clCreateUserEvent(GlobalCl::context(), &errcode);
+		REQUIRE(errcode == CL_SUCCESS);
+		cl_event ev_scatter = cl_rul::scatter_upload(queue, device_buffer, indices, 4, values, gate);
+		cl_float gathered[4] = {};
+		cl_event ev_gather = cl_rul::gather_download(queue, device_buffer, indices, 4, gathered, ev_scatter);
+		REQUIRE(clSetUserEventStatus(gate, CL_COMPLETE) == CL_SUCCESS);
+		REQUIRE(clWaitForEvents(1, &ev_gather) == CL_SUCCESS);
+		check_1D(values, gathered, 4);
+		clReleaseEvent(ev_gather);
+		clReleaseEvent(ev_scatter);
+		clReleaseEvent(gate);
+	}
+
+	clReleaseMemObject(device_buffer);
+	clFinish(queue);
+	clReleaseCommandQueue(queue);
+}